@@ -2,6 +2,13 @@
 #include <fmt/format.h>
 #include <IO/Filepath.h>
 #include <IO/CSVReader.h>
+#include <IO/CSVPushParser.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
 
 using namespace Wikinger;
 
@@ -21,6 +28,229 @@ private:
   uint32_t mc = 0;
 };
 
+// Touches every token so that the parse can not be optimized away.
+class CSV_Sum {
+public:
+  void operator()(Error& err, uint32_t row, uint32_t col, CSVReader::Token& tk) {
+    sum += tk.get<std::string_view>(err).size();
+  }
+
+  size_t sum = 0;
+};
+
+// Times read() with a callback against iterating rows() over the same file,
+// the best of a few runs of each is reported.
+void benchRows(const Filepath& path) {
+  typedef std::chrono::steady_clock Clock;
+  double best_read = 0.0;
+  double best_rows = 0.0;
+  size_t sum_read = 0;
+  size_t sum_rows = 0;
+
+  for(int run = 0; run < 5; run++) {
+    Error err;
+    CSVReader reader;
+    reader.open(err, path);
+
+    CSV_Sum clb;
+    Clock::time_point t0 = Clock::now();
+    reader.read(err, clb);
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    best_read = run == 0 || ms < best_read ? ms : best_read;
+    sum_read = clb.sum;
+    reader.close();
+
+    reader.open(err, path);
+    size_t sum = 0;
+    t0 = Clock::now();
+    for(const CSVRow& r : reader.rows(err)) {
+      for(size_t c = 0; c < r.size(); c++) {
+        sum += r[c].get<std::string_view>(err).size();
+      }
+    }
+    ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    best_rows = run == 0 || ms < best_rows ? ms : best_rows;
+    sum_rows = sum;
+    reader.close();
+
+    if(!err.isOk()) {
+      WK_ERROR("Bench: {}", err.getMsg());
+      return;
+    }
+  }
+
+  if(sum_read != sum_rows)
+    WK_ERROR("Bench: read() saw {} bytes of tokens, rows() {}", sum_read, sum_rows);
+
+  WK_INFO("Bench: read() {:.2f} ms, rows() {:.2f} ms, rows() / read() {:.2f}", best_read, best_rows, best_rows / best_read);
+}
+
+// Collects the tokens row by row so that the read paths can be compared with
+// each other, base renumbers the rows of a range to their row in the file.
+class CSV_Collect {
+public:
+  void operator()(Error& err, uint32_t row, uint32_t col, CSVReader::Token& tk) {
+    uint64_t r = base + row;
+    if(r >= rows.size())
+      rows.resize(r + 1);
+    rows[r] += fmt::format("{}={}\n", col, tk.get<std::string_view>(err));
+  }
+
+  std::vector<std::string> rows;
+  uint64_t base = 0;
+};
+
+// Random rows of plain and quoted fields, the quoted ones hold separators,
+// newlines and doubled quotes and with escapes escaped quotes and even runs
+// of backslashes as well. The long fields make quotes and escapes straddle
+// the blocks.
+std::string makeCSV(std::mt19937& rng, size_t rows, bool escapes) {
+  const char plain[] = "abcxyz ";
+  const char quoted[] = "abc ,\n";
+  std::string s;
+
+  for(size_t r = 0; r < rows; r++) {
+    uint32_t cols = 1 + rng() % 6;
+    for(uint32_t c = 0; c < cols; c++) {
+      if(c > 0)
+        s += ',';
+
+      uint32_t len = rng() % (rng() % 4 == 0 ? 200 : 20);
+      if(rng() % 2 == 0) {
+        for(uint32_t i = 0; i < len; i++) {
+          s += plain[rng() % (sizeof(plain) - 1)];
+        }
+        continue;
+      }
+
+      s += '"';
+      for(uint32_t i = 0; i < len; i++) {
+        uint32_t k = rng() % 16;
+        if(k == 0)
+          s += "\"\"";
+        else if(escapes && k == 1)
+          s += "\\\"";
+        else if(escapes && k == 2)
+          s.append(2 + rng() % 4 * 2, '\\');
+        else
+          s += quoted[rng() % (sizeof(quoted) - 1)];
+      }
+      s += '"';
+    }
+    s += '\n';
+  }
+
+  // the last row without its newline every other time.
+  if(rng() % 2 == 0)
+    s.pop_back();
+  return s;
+}
+
+// Reads the file at path, which holds data, through read, the parallel, range,
+// pipelined and push parsers, rows() and tail and compares their rows.
+// The chunks and ranges are cut small and at unaligned offsets.
+bool checkPaths(const Filepath& path, const std::string& data, std::mt19937& rng) {
+  Error err;
+  CSVReader reader;
+  uint32_t bad = 0;
+
+  reader.open(err, path);
+  CSV_Collect want;
+  reader.read(err, want);
+  reader.close();
+
+  auto check = [&](const char* name, const std::vector<std::string>& got) {
+    if(got != want.rows) {
+      WK_ERROR("Check: {} disagrees with read() on '{}', {} rows instead of {}", name, path, got.size(), want.rows.size());
+      bad++;
+    }
+  };
+
+  reader.open(err, path);
+  reader.setChunkSize(4096);
+  CSV_Collect par;
+  reader.readParallel(err, par, 4);
+  reader.close();
+  check("readParallel()", par.rows);
+
+  reader.open(err, path);
+  std::vector<int64_t> cuts{ 0, 1, 63, 65, 4095, 4097, (int64_t)data.size() };
+  for(uint32_t i = 0; i < 8; i++) {
+    cuts.push_back(rng() % (data.size() + 1));
+  }
+  std::sort(cuts.begin(), cuts.end());
+
+  CSV_Collect range;
+  for(size_t i = 0; i + 1 < cuts.size(); i++) {
+    range.base = range.rows.size();
+    reader.read(err, range, CSVReader::Range{ cuts[i], cuts[i + 1] });
+  }
+  reader.close();
+  check("read() of ranges", range.rows);
+
+  reader.open(err, path);
+  reader.setPipeline(3);
+  CSV_Collect pipe;
+  reader.read(err, pipe);
+  reader.close();
+  check("the pipeline", pipe.rows);
+
+  CSVPushParser push;
+  CSV_Collect pushed;
+  for(size_t i = 0; i < data.size();) {
+    size_t n = std::min<size_t>(1 + rng() % 200, data.size() - i);
+    push.feed(err, pushed, data.data() + i, n);
+    i += n;
+  }
+  push.finish(err, pushed);
+  check("CSVPushParser", pushed.rows);
+
+  reader.open(err, path);
+  std::vector<std::string> rows;
+  for(const CSVRow& r : reader.rows(err)) {
+    std::string s;
+    for(size_t c = 0; c < r.size(); c++) {
+      s += fmt::format("{}={}\n", c, r[c].get<std::string_view>(err));
+    }
+    rows.push_back(s);
+  }
+  reader.close();
+  check("rows()", rows);
+
+  reader.open(err, path);
+  for(uint64_t n : { (uint64_t)1, (uint64_t)7, (uint64_t)100, (uint64_t)want.rows.size() }) {
+    CSV_Collect tail;
+    reader.tail(err, tail, n);
+
+    // the rows of the tail count from its first row.
+    std::vector<std::string> last(want.rows.end() - std::min<size_t>(n, want.rows.size()), want.rows.end());
+    if(tail.rows != last) {
+      WK_ERROR("Check: tail({}) disagrees with read() on '{}'", n, path);
+      bad++;
+    }
+  }
+  reader.close();
+
+  if(!err.isOk()) {
+    WK_ERROR("Check: {}", err.getMsg());
+    return false;
+  }
+
+  WK_INFO("Check: {} rows of '{}', {} of the paths disagree", want.rows.size(), path, bad);
+  return bad == 0;
+}
+
+// Writes the generated data for checkPaths to a file.
+bool writeFile(const Filepath& path, const std::string& data) {
+  FILE* f = nullptr;
+  if(fopen_s(&f, path.getPtr(), "wb") != 0)
+    return false;
+
+  size_t written = fwrite(data.data(), 1, data.size(), f);
+  fclose(f);
+  return written == data.size();
+}
+
 int main(int argc, char** argv) {
   Log::init();
 
@@ -38,6 +268,18 @@ int main(int argc, char** argv) {
 
     reader.close();
 
+    benchRows("C:/Source/Matlab/ODE/odesol2.csv");
+  }
+
+  {
+    std::mt19937 rng(26);
+    std::string quoted = makeCSV(rng, 20000, false);
+    std::string escaped = makeCSV(rng, 20000, true);
+
+    if(writeFile("sandbox_quoted.csv", quoted))
+      checkPaths("sandbox_quoted.csv", quoted, rng);
+    if(writeFile("sandbox_escaped.csv", escaped))
+      checkPaths("sandbox_escaped.csv", escaped, rng);
   }
   
   WK_INFO("Done!");
@@ -0,0 +1,181 @@
+#include "Platform.h"
+#include "Allocator.h"
+
+#include <stdlib.h>
+
+#if WK_PLATFORM_WINDOWS || WK_PLATFORM_XBOXONE || WK_PLATFORM_WINRT
+#include <Windows.h>
+#include <malloc.h>
+#endif
+
+#if WK_PLATFORM_LINUX
+#include <sys/mman.h>
+#endif
+
+namespace Wikinger {
+
+namespace detail {
+namespace alloc {
+
+void* alignedMalloc(size_t size, size_t alignment) {
+#if WK_PLATFORM_WINDOWS || WK_PLATFORM_XBOXONE || WK_PLATFORM_WINRT
+  return _aligned_malloc(size, alignment);
+#else
+  void* p = nullptr;
+  if(alignment < sizeof(void*))
+    alignment = sizeof(void*);
+  return posix_memalign(&p, alignment, size) == 0 ? p : nullptr;
+#endif
+}
+
+void alignedFree(void* p) {
+#if WK_PLATFORM_WINDOWS || WK_PLATFORM_XBOXONE || WK_PLATFORM_WINRT
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+
+size_t roundUp(size_t size, size_t page) {
+  return (size + page - 1) / page * page;
+}
+
+}
+}
+
+void* AlignedAllocator::allocate(size_t size, size_t alignment) {
+  return detail::alloc::alignedMalloc(size, alignment);
+}
+
+void AlignedAllocator::deallocate(void* p, size_t size, size_t alignment) {
+  detail::alloc::alignedFree(p);
+}
+
+#if WK_PLATFORM_WINDOWS || WK_PLATFORM_XBOXONE || WK_PLATFORM_WINRT
+
+HugePageArena::HugePageArena(size_t _threshold) : threshold(_threshold) {
+  page = GetLargePageMinimum();
+}
+
+// VirtualAlloc hands out memory aligned to the allocation granularity of 64KB,
+// which is more than any sector size the readers align to.
+void* HugePageArena::allocate(size_t size, size_t alignment) {
+  if(size < threshold || alignment > 64 * 1024)
+    return detail::alloc::alignedMalloc(size, alignment);
+
+  void* p = nullptr;
+  if(page != 0)
+    p = VirtualAlloc(nullptr, detail::alloc::roundUp(size, page), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+  if(p == nullptr)
+    p = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  return p;
+}
+
+void HugePageArena::deallocate(void* p, size_t size, size_t alignment) {
+  if(size < threshold || alignment > 64 * 1024) {
+    detail::alloc::alignedFree(p);
+    return;
+  }
+  VirtualFree(p, 0, MEM_RELEASE);
+}
+
+#elif WK_PLATFORM_LINUX
+
+HugePageArena::HugePageArena(size_t _threshold) : threshold(_threshold) {
+  page = 2 * 1024 * 1024;
+}
+
+// Either mapping is page aligned to the huge page size, which is more than any
+// sector size the readers align to.
+void* HugePageArena::allocate(size_t size, size_t alignment) {
+  if(size < threshold || alignment > page)
+    return detail::alloc::alignedMalloc(size, alignment);
+
+  size_t len = detail::alloc::roundUp(size, page);
+  void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if(p != MAP_FAILED)
+    return p;
+
+  // transparent huge pages are only used for 2MB aligned ranges so a page more
+  // is mapped and the ends are trimmed to get one.
+  char* m = (char*)mmap(nullptr, len + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(m == MAP_FAILED)
+    return nullptr;
+
+  size_t head = (page - (uintptr_t)m % page) % page;
+  if(head > 0)
+    munmap(m, head);
+  munmap(m + head + len, page - head);
+
+  madvise(m + head, len, MADV_HUGEPAGE);
+  return m + head;
+}
+
+void HugePageArena::deallocate(void* p, size_t size, size_t alignment) {
+  if(size < threshold || alignment > page) {
+    detail::alloc::alignedFree(p);
+    return;
+  }
+  munmap(p, detail::alloc::roundUp(size, page));
+}
+
+#else
+
+HugePageArena::HugePageArena(size_t _threshold) : threshold(_threshold), page(0) {}
+
+void* HugePageArena::allocate(size_t size, size_t alignment) {
+  return detail::alloc::alignedMalloc(size, alignment);
+}
+
+void HugePageArena::deallocate(void* p, size_t size, size_t alignment) {
+  detail::alloc::alignedFree(p);
+}
+
+#endif
+
+CountingAllocator::CountingAllocator(AllocatorI& _base) :
+  base(_base), bytes(0), peak(0), live(0), total(0) {}
+
+void* CountingAllocator::allocate(size_t size, size_t alignment) {
+  void* p = base.allocate(size, alignment);
+  if(p == nullptr)
+    return p;
+
+  size_t now = bytes.fetch_add(size, std::memory_order_relaxed) + size;
+  size_t top = peak.load(std::memory_order_relaxed);
+  while(now > top && !peak.compare_exchange_weak(top, now, std::memory_order_relaxed));
+
+  live.fetch_add(1, std::memory_order_relaxed);
+  total.fetch_add(1, std::memory_order_relaxed);
+  return p;
+}
+
+void CountingAllocator::deallocate(void* p, size_t size, size_t alignment) {
+  if(p == nullptr)
+    return;
+
+  base.deallocate(p, size, alignment);
+  bytes.fetch_sub(size, std::memory_order_relaxed);
+  live.fetch_sub(1, std::memory_order_relaxed);
+}
+
+namespace detail {
+namespace alloc {
+
+std::atomic<AllocatorI*> current{ nullptr };
+
+}
+}
+
+AllocatorI& getAllocator() {
+  static HugePageArena arena;
+
+  AllocatorI* a = detail::alloc::current.load(std::memory_order_acquire);
+  return a != nullptr ? *a : arena;
+}
+
+void setAllocator(AllocatorI* alloc) {
+  detail::alloc::current.store(alloc, std::memory_order_release);
+}
+
+}
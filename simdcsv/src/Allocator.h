@@ -0,0 +1,118 @@
+#ifndef WK_ALLOCATOR_H
+#define WK_ALLOCATOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+
+namespace Wikinger {
+
+// An allocator of aligned memory. The buffers of the readers, the indices and
+// the materialized rows are all allocated through the one returned by
+// getAllocator, deallocate is passed the same size and alignment as allocate.
+class AllocatorI {
+public:
+  virtual ~AllocatorI() = default;
+
+  virtual void* allocate(size_t size, size_t alignment) = 0;
+  virtual void deallocate(void* p, size_t size, size_t alignment) = 0;
+};
+
+// _aligned_malloc and _aligned_free.
+class AlignedAllocator : public AllocatorI {
+public:
+  void* allocate(size_t size, size_t alignment) override;
+  void deallocate(void* p, size_t size, size_t alignment) override;
+};
+
+// Backs every allocation of at least threshold bytes with huge pages, the
+// multi megabyte read buffers are streamed through once per refill and with
+// 4KB pages every one of those refills walks a thousand dTLB entries.
+// On windows large pages need the SeLockMemoryPrivilege, without it the
+// memory is committed with regular pages. On linux MAP_HUGETLB is tried first,
+// when no huge pages are reserved the memory is mapped 2MB aligned and
+// madvise'd for transparent huge pages instead.
+// Smaller allocations go to _aligned_malloc.
+class HugePageArena : public AllocatorI {
+public:
+  HugePageArena(size_t threshold = 1024 * 1024);
+
+  void* allocate(size_t size, size_t alignment) override;
+  void deallocate(void* p, size_t size, size_t alignment) override;
+
+  size_t getPageSize() const { return page; }
+
+private:
+  size_t threshold;
+  size_t page;
+};
+
+// Forwards to another allocator and keeps count of what it hands out.
+class CountingAllocator : public AllocatorI {
+public:
+  CountingAllocator(AllocatorI& base);
+
+  void* allocate(size_t size, size_t alignment) override;
+  void deallocate(void* p, size_t size, size_t alignment) override;
+
+  // bytes currently allocated and the most there have been at once.
+  size_t getBytes() const { return bytes.load(std::memory_order_relaxed); }
+  size_t getPeak() const { return peak.load(std::memory_order_relaxed); }
+
+  // allocations currently alive and the amount made in total.
+  size_t getLive() const { return live.load(std::memory_order_relaxed); }
+  size_t getTotal() const { return total.load(std::memory_order_relaxed); }
+
+private:
+  AllocatorI& base;
+  std::atomic<size_t> bytes;
+  std::atomic<size_t> peak;
+  std::atomic<size_t> live;
+  std::atomic<size_t> total;
+};
+
+// The allocator in use, a HugePageArena unless another one has been set.
+AllocatorI& getAllocator();
+
+// Replaces the allocator in use, nullptr restores the default. Memory has to be
+// returned to the allocator it came from so this is meant to be called before
+// any reader, index or rows exist, and the allocator has to live until the end
+// of the process since the caches pooled across readers are only freed then.
+// Pooled caches remember their allocator and are not handed out once it has
+// been replaced.
+void setAllocator(AllocatorI* alloc);
+
+// Makes an AllocatorI usable by the standard containers, the allocator in use
+// when the container is created is the one it keeps using.
+template<typename T>
+class StdAllocator {
+public:
+  typedef T value_type;
+
+  StdAllocator() : alloc(&getAllocator()) {}
+  template<typename U>
+  StdAllocator(const StdAllocator<U>& o) : alloc(o.alloc) {}
+
+  T* allocate(size_t n) {
+    return (T*)alloc->allocate(n * sizeof(T), alignof(T));
+  }
+  void deallocate(T* p, size_t n) {
+    alloc->deallocate(p, n * sizeof(T), alignof(T));
+  }
+
+  template<typename U>
+  bool operator==(const StdAllocator<U>& o) const { return alloc == o.alloc; }
+  template<typename U>
+  bool operator!=(const StdAllocator<U>& o) const { return alloc != o.alloc; }
+
+private:
+  AllocatorI* alloc;
+
+  template<typename U>
+  friend class StdAllocator;
+};
+
+}
+
+#endif// WK_ALLOCATOR_H
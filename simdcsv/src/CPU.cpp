@@ -257,6 +257,22 @@ double CPUimpl::Load() const {
 }
 #endif
 
+#if WK_PLATFORM_WINDOWS
+uint32_t CPU::NumaNode() {
+  PROCESSOR_NUMBER proc;
+  GetCurrentProcessorNumberEx(&proc);
+
+  USHORT node = 0;
+  if(!GetNumaProcessorNodeEx(&proc, &node))
+    return 0;
+  return node;
+}
+#else
+uint32_t CPU::NumaNode() {
+  return 0;
+}
+#endif
+
 std::string CPU::Vendor() const {
   std::string res;
   res.resize(13);
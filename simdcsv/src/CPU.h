@@ -235,6 +235,9 @@ public:
   // Returns the cpu load across all cores. This function has persistant data
   // and should therefore only be called periodically and it is not thread safe.
   static double Load();
+  // Returns the numa node of the processor the calling thread is running on,
+  // or 0 when it is unknown. The thread may be moved to another node after.
+  static uint32_t NumaNode();
 
   // prints all supported features along with vendor, brand and frequencies.
   void print() const;
@@ -0,0 +1,188 @@
+#include "../Allocator.h"
+#include "../CPU.h"
+
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace Wikinger {
+namespace detail {
+namespace csv {
+
+// A cache buffer of the CSVFileReader. The reader holds a reference to the
+// chunk it is filling and every retained token holds one more, the chunk goes
+// back to the pool once the last of them lets go. A chunk without a pool was
+// allocated for a single copied token and is freed instead.
+struct CSV_Cache {
+  char* mem;
+  size_t size;
+  size_t alignment;
+  std::atomic<uint32_t> refs;
+  bool pooled;
+  AllocatorI* alloc;
+
+  // the numa node of the thread the chunk was first handed to, its pages
+  // are placed on that node when they are first written.
+  uint32_t node;
+};
+
+// The chunks released by the readers of every CSVReader in the process, handed
+// out again to the next reader asking for the same size and alignment so that
+// neither a new reader nor a retained chunk has to go to the allocator and
+// fault in fresh pages. Chunks are kept per numa node and handed out on the
+// node they came from, at most keep chunks are held on to per node.
+class CSV_CachePool {
+public:
+  static CSV_CachePool& get();
+
+  ~CSV_CachePool();
+
+  CSV_Cache* acquire(size_t size, size_t alignment);
+  void release(CSV_Cache* ck);
+
+private:
+  CSV_CachePool() = default;
+
+  std::mutex lock;
+  std::vector<std::vector<CSV_Cache*>> spare;
+  size_t keep = 8;
+};
+
+CSV_CachePool& CSV_CachePool::get() {
+  // the default allocator has to outlive the pool which frees into it.
+  getAllocator();
+  static CSV_CachePool pool;
+  return pool;
+}
+
+CSV_CachePool::~CSV_CachePool() {
+  for(std::vector<CSV_Cache*>& node : spare) {
+    for(CSV_Cache* ck : node) {
+      ck->alloc->deallocate(ck->mem, ck->size, ck->alignment);
+      delete ck;
+    }
+  }
+}
+
+CSV_Cache* CSV_CachePool::acquire(size_t size, size_t alignment) {
+  AllocatorI* alloc = &getAllocator();
+  uint32_t node = CPU::NumaNode();
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if(node < spare.size()) {
+      std::vector<CSV_Cache*>& list = spare[node];
+      for(size_t i = 0; i < list.size(); i++) {
+        CSV_Cache* ck = list[i];
+        if(ck->size == size && ck->alignment == alignment && ck->alloc == alloc) {
+          list[i] = list.back();
+          list.pop_back();
+          ck->refs.store(1, std::memory_order_relaxed);
+          return ck;
+        }
+      }
+    }
+  }
+
+  CSV_Cache* ck = new CSV_Cache;
+  ck->mem = (char*)alloc->allocate(size, alignment);
+  ck->size = size;
+  ck->alignment = alignment;
+  ck->refs.store(1, std::memory_order_relaxed);
+  ck->pooled = true;
+  ck->alloc = alloc;
+  ck->node = node;
+  return ck;
+}
+
+// Drops a reference, the chunk is pooled or freed when it was the last one.
+// Chunks of an allocator which has since been replaced are not pooled.
+void CSV_CachePool::release(CSV_Cache* ck) {
+  if(ck->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    return;
+
+  if(ck->pooled && ck->alloc == &getAllocator()) {
+    std::lock_guard<std::mutex> guard(lock);
+    if(ck->node >= spare.size())
+      spare.resize(ck->node + 1);
+    if(spare[ck->node].size() < keep) {
+      spare[ck->node].push_back(ck);
+      return;
+    }
+  }
+
+  ck->alloc->deallocate(ck->mem, ck->size, ck->alignment);
+  delete ck;
+}
+
+} // namespace csv
+} // namespace detail
+
+// A token kept alive past the callback it was handed to. Holding one keeps the
+// whole cache chunk the token points into, the reader moves on to a fresh chunk
+// from the pool instead of overwriting it. Tokens which do not point into a
+// chunk, such as those of a memory mapped file, are copied into one of their own.
+class CSVRetained {
+public:
+  CSVRetained() : chunk(nullptr) {}
+  CSVRetained(const CSVRetained& o) : mem(o.mem), chunk(o.chunk) {
+    if(chunk != nullptr)
+      chunk->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  CSVRetained(CSVRetained&& o) noexcept : mem(o.mem), chunk(o.chunk) {
+    o.chunk = nullptr;
+    o.mem = std::string_view();
+  }
+  ~CSVRetained() { release(); }
+
+  CSVRetained& operator=(CSVRetained o) {
+    std::swap(mem, o.mem);
+    std::swap(chunk, o.chunk);
+    return *this;
+  }
+
+  std::string_view get() const { return mem; }
+
+  // Lets go of the chunk, the token must not be used after.
+  void release();
+
+private:
+  CSVRetained(std::string_view m, detail::csv::CSV_Cache* ck) : mem(m), chunk(ck) {}
+
+  std::string_view mem;
+  detail::csv::CSV_Cache* chunk;
+
+  friend class CSVReader::Token;
+};
+
+void CSVRetained::release() {
+  if(chunk != nullptr) {
+    detail::csv::CSV_CachePool::get().release(chunk);
+    chunk = nullptr;
+  }
+  mem = std::string_view();
+}
+
+// Costs a reference count increment for tokens read through a CSVFileReader,
+// anything else is copied.
+CSVRetained CSVReader::Token::retain() const {
+  namespace dcsv = detail::csv;
+
+  if(chunk != nullptr) {
+    chunk->refs.fetch_add(1, std::memory_order_relaxed);
+    return CSVRetained(mem, chunk);
+  }
+
+  dcsv::CSV_Cache* ck = new dcsv::CSV_Cache;
+  ck->size = mem.size() + 1;
+  ck->alignment = 16;
+  ck->alloc = &getAllocator();
+  ck->mem = (char*)ck->alloc->allocate(ck->size, ck->alignment);
+  ck->refs.store(1, std::memory_order_relaxed);
+  ck->pooled = false;
+  ck->node = 0;
+  memcpy(ck->mem, mem.data(), mem.size());
+  return CSVRetained(std::string_view(ck->mem, mem.size()), ck);
+}
+
+} // namespace Wikinger
@@ -0,0 +1,306 @@
+namespace Wikinger {
+
+// Content hashes of the blocks of rows of a file, for parsing only what has
+// changed since the hashes were taken.
+// Blocks end after a row whose own hash picks it as a boundary, with every
+// row being picked with a probability proportional to its length. Since the
+// boundaries only depend on the rows around them, rows inserted or removed
+// only change the blocks they are in and the blocks after them line up again.
+// The sidecar is the header followed by the blocks.
+class CSVBlockHashes {
+public:
+  CSVBlockHashes() {}
+
+  Error& save(Error& err, const Filepath& file) const;
+  Error& load(Error& err, const Filepath& file);
+
+  static Filepath getSidecar(const Filepath& csv);
+
+  size_t getBlockCount() const { return blocks.size(); }
+
+  struct Block {
+    int64_t begin;
+    int64_t end;
+    uint64_t first;
+    uint64_t rows;
+    uint32_t hash;
+    uint32_t pad;
+  };
+
+private:
+  friend class CSVReader;
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t pad;
+    uint64_t count;
+  };
+
+  std::vector<Block, StdAllocator<Block>> blocks;
+};
+
+namespace detail {
+namespace csv {
+
+constexpr char CSV_BlockHashMagic[8] = { 'W', 'K', 'C', 'S', 'V', 'C', 'R', 'C' };
+constexpr uint32_t CSV_BlockHashVersion = 1;
+
+// Blocks are at least min and at most max bytes long and about avg on average.
+constexpr int64_t CSV_BlockMin = 1024 * 64;
+constexpr int64_t CSV_BlockMax = 1024 * 1024 * 16;
+constexpr uint32_t CSV_BlockAvgMask = 1024 * 1024 - 1;
+
+// Computes the CRC32C of the data continuing from crc using the SSE4.2 crc32 instruction.
+uint32_t crc32c_sse42(uint32_t crc, const char* data, size_t len) {
+  uint64_t c = ~crc;
+  for(; len >= 8; data += 8, len -= 8) {
+    uint64_t v;
+    memcpy(&v, data, 8);
+    c = _mm_crc32_u64(c, v);
+  }
+  for(; len > 0; data++, len--) {
+    c = _mm_crc32_u8((uint32_t)c, (uint8_t)*data);
+  }
+  return ~(uint32_t)c;
+}
+
+struct CSV_Crc32cTable {
+  CSV_Crc32cTable() {
+    for(uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for(int k = 0; k < 8; k++) {
+        c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+      }
+      t[i] = c;
+    }
+  }
+
+  uint32_t t[256];
+};
+
+// Computes the same CRC32C a byte at a time from a table.
+uint32_t crc32c_x64(uint32_t crc, const char* data, size_t len) {
+  static const CSV_Crc32cTable table;
+
+  uint32_t c = ~crc;
+  for(; len > 0; data++, len--) {
+    c = table.t[(c ^ (uint8_t)*data) & 0xff] ^ (c >> 8);
+  }
+  return ~c;
+}
+
+typedef uint32_t(crcSig)(uint32_t, const char*, size_t);
+
+// Splits the file into blocks of whole rows and hashes them. Every row is
+// hashed on its own and the block hash is the hash of the row hashes.
+// The rows are found with the mask stage alone, nothing is tokenized.
+template<masksSig masks, tzcntSig tzcnt, andnSig andn, crcSig crc>
+void hashBlocks(Error& err, UnbufferedFileReader& file, size_t alignment, char seperator, std::vector<CSVBlockHashes::Block, StdAllocator<CSVBlockHashes::Block>>& blocks) {
+  uint32_t row = 0;
+  uint32_t column = 0;
+  CSV_Context ctx(row, column);
+
+  size_t size = 1024 * 1024;
+  size = (1 + (size - 1) / alignment) * alignment;
+  char* buf = (char*)getAllocator().allocate(size + 64, alignment);
+
+  blocks.clear();
+  CSVBlockHashes::Block curr = { 0, 0, 0, 0, 0, 0 };
+  int64_t begin = 0;
+  uint32_t hash = 0;
+
+  auto endRow = [&](int64_t end) {
+    curr.hash = crc(curr.hash, (const char*)&hash, sizeof(hash));
+    curr.rows++;
+
+    int64_t len = end - begin;
+    int64_t bytes = end - curr.begin;
+    if(bytes >= CSV_BlockMax || (bytes >= CSV_BlockMin && (int64_t)(hash & CSV_BlockAvgMask) < len)) {
+      curr.end = end;
+      blocks.push_back(curr);
+      curr = { end, end, curr.first + curr.rows, 0, 0, 0 };
+    }
+
+    begin = end;
+    hash = 0;
+  };
+
+  file.seek(err, 0, Whence::Begin);
+
+  int64_t pos = 0;
+  size_t read;
+  do {
+    read = file.readbin(err, buf, size);
+    size_t done = 0;
+
+    for(size_t i = 0; i < read; i += 64) {
+      masks(ctx, buf + i, seperator);
+      uint64_t fill = quoteFill<andn>(ctx, read - i);
+      uint64_t nl = andn(fill, ctx.nl_mask);
+
+      for(; nl != 0; nl &= nl - 1) {
+        size_t e = i + tzcnt(nl) + 1;
+        if(e > read)
+          break;
+
+        hash = crc(hash, buf + done, e - done);
+        done = e;
+        endRow(pos + e);
+      }
+    }
+
+    hash = crc(hash, buf + done, read - done);
+    pos += read;
+  } while(read == size && err.peekOk());
+
+  getAllocator().deallocate(buf, size + 64, alignment);
+
+  if(pos > begin)
+    endRow(pos);
+  if(curr.rows > 0) {
+    curr.end = pos;
+    blocks.push_back(curr);
+  }
+}
+
+} // namespace csv
+} // namespace detail
+
+Filepath CSVBlockHashes::getSidecar(const Filepath& csv) {
+  std::string p = csv;
+  p += ".crc";
+  return Filepath(std::string_view(p));
+}
+
+Error& CSVBlockHashes::save(Error& err, const Filepath& file) const {
+  if(!err.peekOk())
+    return err;
+
+  FILE* f = detail::csv::openSidecar(file, "wb");
+  if(f == nullptr) {
+    WK_RAISE_ERR(err, CannotOpen, "CSVBlockHashes: Couldn't create '{}'", file);
+    return err;
+  }
+
+  Header h;
+  memcpy(h.magic, detail::csv::CSV_BlockHashMagic, sizeof(h.magic));
+  h.version = detail::csv::CSV_BlockHashVersion;
+  h.pad = 0;
+  h.count = blocks.size();
+
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  ok = ok && fwrite(blocks.data(), sizeof(Block), blocks.size(), f) == blocks.size();
+  ok = fclose(f) == 0 && ok;
+
+  if(!ok)
+    WK_RAISE_ERR(err, ReaderWriter_Write, "CSVBlockHashes: Couldn't write '{}'", file);
+  return err;
+}
+
+Error& CSVBlockHashes::load(Error& err, const Filepath& file) {
+  if(!err.peekOk())
+    return err;
+
+  FILE* f = detail::csv::openSidecar(file, "rb");
+  if(f == nullptr) {
+    WK_RAISE_ERR(err, CannotOpen, "CSVBlockHashes: Couldn't open '{}'", file);
+    return err;
+  }
+
+  Header h;
+  bool ok = fread(&h, sizeof(h), 1, f) == 1;
+  ok = ok && memcmp(h.magic, detail::csv::CSV_BlockHashMagic, sizeof(h.magic)) == 0;
+  ok = ok && h.version == detail::csv::CSV_BlockHashVersion;
+
+  if(ok) {
+    blocks.resize(h.count);
+    ok = fread(blocks.data(), sizeof(Block), blocks.size(), f) == blocks.size();
+  }
+  fclose(f);
+
+  if(!ok) {
+    blocks.clear();
+    WK_RAISE_ERR(err, InvalidFormat, "CSVBlockHashes: '{}' is not a block hash file", file);
+    return err;
+  }
+  return err;
+}
+
+// Parses only the rows in blocks which were not in the file when the hashes
+// were taken and replaces the hashes with those of the file as it is now.
+// With no hashes every row is new. Rows keep their numbers in the file as it
+// is now, rows which were removed are not reported.
+// Finding the blocks costs a pass over the file with the mask stage and the
+// crc instruction, which is a fraction of parsing it.
+template<typename F>
+Error& CSVReader::readChanged(Error& err, F& clb, CSVBlockHashes& hashes) {
+  namespace dcsv = detail::csv;
+
+  if(!err.peekOk())
+    return err;
+
+  if(!reader.isOpen()) {
+    WK_RAISE_ERR(err, NotOpen, "CSVReader: no file open to read");
+    return err;
+  }
+
+  static RuntimeDispatch<void(Error&, UnbufferedFileReader&, size_t, char, std::vector<CSVBlockHashes::Block, StdAllocator<CSVBlockHashes::Block>>&)> dispatchHash{
+    { dcsv::hashBlocks<dcsv::masks_AVX2, dcsv::tzcnt_bmi, dcsv::andn_bmi, dcsv::crc32c_sse42>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 | CPU::ISA::sse42 },
+    { dcsv::hashBlocks<dcsv::masks_SSE2, dcsv::tzcnt_bmi, dcsv::andn_bmi, dcsv::crc32c_sse42>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 | CPU::ISA::sse42 },
+    { dcsv::hashBlocks<dcsv::masks_x64, dcsv::tzcnt_bmi, dcsv::andn_bmi, dcsv::crc32c_sse42>, CPU::ISA::bmi1 | CPU::ISA::sse42 },
+    { dcsv::hashBlocks<dcsv::masks_AVX2, dcsv::tzcnt_x64, dcsv::andn_x64, dcsv::crc32c_x64>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { dcsv::hashBlocks<dcsv::masks_SSE2, dcsv::tzcnt_x64, dcsv::andn_x64, dcsv::crc32c_x64>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { dcsv::hashBlocks<dcsv::masks_x64, dcsv::tzcnt_x64, dcsv::andn_x64, dcsv::crc32c_x64>, 0 }
+  };
+  static RuntimeDispatch<Error&(Error&, dcsv::CSV_RowOffset<F>&, uint32_t&, uint32_t&, char, dcsv::CSVFileReader&)> dispatch{
+    { dcsv::readCSV_AVX2<false, dcsv::tzcnt_bmi, dcsv::andn_bmi, dcsv::CSV_RowOffset<F>>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 },
+    { dcsv::readCSV_SSE2<false, dcsv::tzcnt_bmi, dcsv::andn_bmi, dcsv::CSV_RowOffset<F>>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 },
+    { dcsv::readCSV_bmi1<false, dcsv::tzcnt_bmi, dcsv::andn_bmi, dcsv::CSV_RowOffset<F>>, CPU::ISA::bmi1 },
+    { dcsv::readCSV_AVX2<false, dcsv::tzcnt_x64, dcsv::andn_x64, dcsv::CSV_RowOffset<F>>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { dcsv::readCSV_SSE2<false, dcsv::tzcnt_x64, dcsv::andn_x64, dcsv::CSV_RowOffset<F>>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { dcsv::readCSV_bmi1<false, dcsv::tzcnt_x64, dcsv::andn_x64, dcsv::CSV_RowOffset<F>>, 0 }
+  };
+
+  std::vector<CSVBlockHashes::Block, StdAllocator<CSVBlockHashes::Block>> blocks;
+  dispatchHash(err, reader, req_alignment, seperator, blocks);
+  if(!err.peekOk())
+    return err;
+
+  // blocks are known by their hash and length, where they were does not matter.
+  auto less = [](const CSVBlockHashes::Block& a, const CSVBlockHashes::Block& b) {
+    return a.hash < b.hash || (a.hash == b.hash && a.end - a.begin < b.end - b.begin);
+  };
+  std::vector<CSVBlockHashes::Block, StdAllocator<CSVBlockHashes::Block>> known = hashes.blocks;
+  std::sort(known.begin(), known.end(), less);
+
+  dcsv::CSV_RowOffset<F> fwd(clb, 0);
+  dcsv::CSVFileReader cread(reader, req_alignment);
+
+  size_t n = blocks.size();
+  for(size_t k = 0; k < n && err.peekOk(); k++) {
+    if(std::binary_search(known.begin(), known.end(), blocks[k], less))
+      continue;
+
+    // adjacent changed blocks are parsed as one range.
+    size_t last = k;
+    while(last + 1 < n && !std::binary_search(known.begin(), known.end(), blocks[last + 1], less)) {
+      last++;
+    }
+
+    fwd.base = (uint32_t)blocks[k].first;
+    row = 0;
+    column = 0;
+    cread.setRange(err, blocks[k].begin, blocks[last].end);
+    dispatch(err, fwd, row, column, seperator, cread);
+
+    k = last;
+  }
+
+  hashes.blocks.swap(blocks);
+  row = 0;
+  column = 0;
+  return err;
+}
+
+} // namespace Wikinger
@@ -0,0 +1,144 @@
+namespace Wikinger {
+
+// Where a read stopped, taken between two rows. Between rows the parser is
+// outside of quotes and not escaping so the quote and escape carries are
+// known to be clear, the offset of the next row and the number it gets is
+// all the parser needs to carry on. The size of the file is kept to detect
+// a file which has been truncated since.
+struct CSVCheckpoint {
+  int64_t offset = 0;
+  uint32_t row = 0;
+  uint64_t size = 0;
+
+  Error& save(Error& err, const Filepath& file) const;
+  Error& load(Error& err, const Filepath& file);
+};
+
+namespace detail {
+namespace csv {
+
+constexpr char CSV_CheckpointMagic[8] = { 'W', 'K', 'C', 'S', 'V', 'C', 'P', 'T' };
+constexpr uint32_t CSV_CheckpointVersion = 1;
+
+struct CSV_CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t row;
+  int64_t offset;
+  uint64_t size;
+};
+
+} // namespace csv
+} // namespace detail
+
+Error& CSVCheckpoint::save(Error& err, const Filepath& file) const {
+  if(!err.peekOk())
+    return err;
+
+  FILE* f = detail::csv::openSidecar(file, "wb");
+  if(f == nullptr) {
+    WK_RAISE_ERR(err, CannotOpen, "CSVCheckpoint: Couldn't create '{}'", file);
+    return err;
+  }
+
+  detail::csv::CSV_CheckpointHeader h;
+  memcpy(h.magic, detail::csv::CSV_CheckpointMagic, sizeof(h.magic));
+  h.version = detail::csv::CSV_CheckpointVersion;
+  h.row = row;
+  h.offset = offset;
+  h.size = size;
+
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  ok = fclose(f) == 0 && ok;
+
+  if(!ok)
+    WK_RAISE_ERR(err, ReaderWriter_Write, "CSVCheckpoint: Couldn't write '{}'", file);
+  return err;
+}
+
+Error& CSVCheckpoint::load(Error& err, const Filepath& file) {
+  if(!err.peekOk())
+    return err;
+
+  FILE* f = detail::csv::openSidecar(file, "rb");
+  if(f == nullptr) {
+    WK_RAISE_ERR(err, CannotOpen, "CSVCheckpoint: Couldn't open '{}'", file);
+    return err;
+  }
+
+  detail::csv::CSV_CheckpointHeader h;
+  bool ok = fread(&h, sizeof(h), 1, f) == 1;
+  ok = ok && memcmp(h.magic, detail::csv::CSV_CheckpointMagic, sizeof(h.magic)) == 0;
+  ok = ok && h.version == detail::csv::CSV_CheckpointVersion;
+  fclose(f);
+
+  if(!ok) {
+    WK_RAISE_ERR(err, InvalidFormat, "CSVCheckpoint: '{}' is not a checkpoint", file);
+    return err;
+  }
+
+  row = h.row;
+  offset = h.offset;
+  size = h.size;
+  return err;
+}
+
+// The checkpoint after the row last returned, or where the rows begin before any was.
+CSVCheckpoint CSVRows::getCheckpoint() const {
+  CSVCheckpoint cp;
+  cp.offset = mem == nullptr ? pos + (int64_t)skip : base + (int64_t)tk;
+  cp.row = row;
+  cp.size = (uint64_t)reader.size(err);
+  return cp;
+}
+
+// Checkpoints are due every bytes bytes or ms milliseconds, zero turns either off.
+void CSVRows::setCheckpointInterval(uint64_t bytes, uint32_t ms) {
+  cp_bytes = bytes;
+  cp_ms = ms;
+  cp_offset = getCheckpoint().offset;
+  cp_time = std::chrono::steady_clock::now();
+  cp_due = false;
+}
+
+// Fills in the checkpoint and returns true when one is due, meant to be called
+// after every row. The clock is only looked at when a buffer is read so the
+// common case is a single comparison.
+bool CSVRows::checkpoint(CSVCheckpoint& cp) {
+  int64_t at = mem == nullptr ? pos + (int64_t)skip : base + (int64_t)tk;
+  bool due = cp_due || (cp_bytes != 0 && (uint64_t)(at - cp_offset) >= cp_bytes);
+  if(!due)
+    return false;
+
+  cp = getCheckpoint();
+  cp_offset = cp.offset;
+  cp_time = std::chrono::steady_clock::now();
+  cp_due = false;
+  return true;
+}
+
+// Continues reading at the checkpoint, the next read or rows picks up with
+// the row after it as if the file had been read up to there.
+Error& CSVReader::resume(Error& err, const CSVCheckpoint& cp) {
+  if(!err.peekOk())
+    return err;
+
+  if(!reader.isOpen()) {
+    WK_RAISE_ERR(err, NotOpen, "CSVReader: no file open to read");
+    return err;
+  }
+
+  // a file may have grown since but one which is shorter than it was has been
+  // truncated, and possibly written past the offset again.
+  if(reader.size(err) < (int64_t)cp.size || reader.size(err) < cp.offset) {
+    WK_RAISE_ERR(err, InvalidFormat, "CSVReader: '{}' is shorter than the checkpoint", path);
+    return err;
+  }
+
+  reader.seek(err, cp.offset, Whence::Begin);
+  row = cp.row;
+  column = 0;
+  return err;
+}
+
+} // namespace Wikinger
@@ -0,0 +1,130 @@
+namespace Wikinger {
+namespace detail {
+namespace csv {
+
+// Counts the rows of the file and, when columns is set, the most columns of any row.
+// This is the mask stage alone, the newlines and seperators outside of quotes
+// are counted with a popcount. Without columns a block costs a single popcount,
+// with them a popcount per row ending in the block.
+template<masksSig masks, andnSig andn, popcntSig popcnt, bool columns>
+void countRows(Error& err, UnbufferedFileReader& file, size_t alignment, char seperator, uint64_t& rows, uint64_t& cols) {
+  uint32_t row = 0;
+  uint32_t column = 0;
+  CSV_Context ctx(row, column);
+
+  size_t size = 1024 * 1024;
+  size = (1 + (size - 1) / alignment) * alignment;
+  char* buf = (char*)getAllocator().allocate(size + 64, alignment);
+
+  uint64_t n = 0;
+  uint64_t seps = 0;
+  uint64_t widest = 0;
+  uint64_t total = 0;
+  bool open = false;
+
+  file.seek(err, 0, Whence::Begin);
+
+  size_t read;
+  do {
+    read = file.readbin(err, buf, size);
+
+    for(size_t i = 0; i < read; i += 64) {
+      masks(ctx, buf + i, seperator);
+      uint64_t fill = quoteFill<andn>(ctx, read - i);
+      uint64_t nl = andn(fill, ctx.nl_mask);
+      n += popcnt(nl);
+
+      if(columns) {
+        uint64_t sep = andn(fill, ctx.sep_mask);
+
+        for(; nl != 0; nl &= nl - 1) {
+          uint64_t before = (nl & (0 - nl)) - 1;
+          seps += popcnt(sep & before);
+          widest = seps + 1 > widest ? seps + 1 : widest;
+          sep = andn(before, sep);
+          seps = 0;
+        }
+        seps += popcnt(sep);
+      }
+
+      if(i + 64 >= read)
+        open = !((andn(fill, ctx.nl_mask) >> (read - 1 - i)) & 1);
+    }
+
+    total += read;
+  } while(read == size && err.peekOk());
+
+  getAllocator().deallocate(buf, size + 64, alignment);
+
+  // the last row has no newline when the file does not end with one.
+  if(total > 0 && open) {
+    n++;
+    widest = seps + 1 > widest ? seps + 1 : widest;
+  }
+
+  rows = n;
+  cols = widest;
+}
+
+} // namespace csv
+} // namespace detail
+
+// Returns the amount of rows in the file without parsing it, the file is left
+// at its beginning. Newlines inside quotes are not counted.
+uint64_t CSVReader::count(Error& err) {
+  namespace dcsv = detail::csv;
+
+  if(!err.peekOk())
+    return 0;
+
+  if(!reader.isOpen()) {
+    WK_RAISE_ERR(err, NotOpen, "CSVReader: no file open to read");
+    return 0;
+  }
+
+  static RuntimeDispatch<void(Error&, UnbufferedFileReader&, size_t, char, uint64_t&, uint64_t&)> dispatch{
+    { dcsv::countRows<dcsv::masks_AVX2, dcsv::andn_bmi, dcsv::popcnt_abm, false>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 | CPU::ISA::popcnt },
+    { dcsv::countRows<dcsv::masks_SSE2, dcsv::andn_bmi, dcsv::popcnt_abm, false>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 | CPU::ISA::popcnt },
+    { dcsv::countRows<dcsv::masks_x64, dcsv::andn_bmi, dcsv::popcnt_abm, false>, CPU::ISA::bmi1 | CPU::ISA::popcnt },
+    { dcsv::countRows<dcsv::masks_AVX2, dcsv::andn_x64, dcsv::popcnt_x64, false>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { dcsv::countRows<dcsv::masks_SSE2, dcsv::andn_x64, dcsv::popcnt_x64, false>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { dcsv::countRows<dcsv::masks_x64, dcsv::andn_x64, dcsv::popcnt_x64, false>, 0 }
+  };
+
+  uint64_t rows = 0;
+  uint64_t cols = 0;
+  dispatch(err, reader, req_alignment, seperator, rows, cols);
+
+  reader.seek(err, 0, Whence::Begin);
+  return rows;
+}
+
+// Returns the amount of rows and the most columns of any of them, see count.
+CSVReader::Shape CSVReader::shape(Error& err) {
+  namespace dcsv = detail::csv;
+
+  Shape s;
+  if(!err.peekOk())
+    return s;
+
+  if(!reader.isOpen()) {
+    WK_RAISE_ERR(err, NotOpen, "CSVReader: no file open to read");
+    return s;
+  }
+
+  static RuntimeDispatch<void(Error&, UnbufferedFileReader&, size_t, char, uint64_t&, uint64_t&)> dispatch{
+    { dcsv::countRows<dcsv::masks_AVX2, dcsv::andn_bmi, dcsv::popcnt_abm, true>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 | CPU::ISA::popcnt },
+    { dcsv::countRows<dcsv::masks_SSE2, dcsv::andn_bmi, dcsv::popcnt_abm, true>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 | CPU::ISA::popcnt },
+    { dcsv::countRows<dcsv::masks_x64, dcsv::andn_bmi, dcsv::popcnt_abm, true>, CPU::ISA::bmi1 | CPU::ISA::popcnt },
+    { dcsv::countRows<dcsv::masks_AVX2, dcsv::andn_x64, dcsv::popcnt_x64, true>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { dcsv::countRows<dcsv::masks_SSE2, dcsv::andn_x64, dcsv::popcnt_x64, true>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { dcsv::countRows<dcsv::masks_x64, dcsv::andn_x64, dcsv::popcnt_x64, true>, 0 }
+  };
+
+  dispatch(err, reader, req_alignment, seperator, s.rows, s.columns);
+
+  reader.seek(err, 0, Whence::Begin);
+  return s;
+}
+
+} // namespace Wikinger
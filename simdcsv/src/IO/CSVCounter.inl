@@ -0,0 +1,66 @@
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace Wikinger {
+namespace detail {
+namespace csv {
+
+// A counter advanced by one thread and waited on by another, as the produced
+// and consumed counts of the rings handing buffers between threads.
+// The waiting side spins for a short while since the other side is usually
+// about to get there, then it sleeps until the counter is stored to or
+// notified so that a thread blocked in a read or in the callback does not keep
+// a core busy on the other side. Sleepers are counted so that a store nobody
+// waits on does not take the lock.
+class CSV_Counter {
+public:
+  CSV_Counter(uint64_t v = 0) : value(v), sleepers(0) {}
+
+  uint64_t load() const { return value.load(std::memory_order_acquire); }
+
+  void store(uint64_t v) {
+    value.store(v, std::memory_order_release);
+    notify();
+  }
+
+  // Wakes the waiting thread without changing the counter, for when what it
+  // waits on depends on more than the counter.
+  void notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(sleepers.load(std::memory_order_relaxed) == 0)
+      return;
+
+    // taking the lock orders this after a sleeper checking its predicate.
+    { std::lock_guard<std::mutex> lock(mtx); }
+    cv.notify_all();
+  }
+
+  // Returns once pred returns true, pred is called again after every store
+  // and notify.
+  template<typename Pred>
+  void wait(Pred&& pred) {
+    for(uint32_t spin = 0; spin < 64; spin++) {
+      if(pred())
+        return;
+      std::this_thread::yield();
+    }
+
+    std::unique_lock<std::mutex> lock(mtx);
+    sleepers.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    cv.wait(lock, pred);
+    sleepers.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> value;
+  std::atomic<uint32_t> sleepers;
+  std::mutex mtx;
+  std::condition_variable cv;
+};
+
+} // namespace csv
+} // namespace detail
+} // namespace Wikinger
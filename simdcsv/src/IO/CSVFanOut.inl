@@ -0,0 +1,267 @@
+#include <functional>
+
+namespace Wikinger {
+namespace detail {
+namespace csv {
+
+// Bounded single producer single consumer queue of batch numbers
+// from the router to one of the consumers.
+class CSV_BatchQueue {
+public:
+  CSV_BatchQueue(uint32_t capacity) :
+    items(new uint64_t[capacity]), cap(capacity), head(0), tail(0) {}
+
+  bool tryPush(uint64_t v) {
+    uint64_t t = tail.load();
+    if(t - head.load() >= cap)
+      return false;
+    items[t % cap] = v;
+    tail.store(t + 1);
+    return true;
+  }
+
+  bool tryPop(uint64_t& v) {
+    uint64_t h = head.load();
+    if(h == tail.load())
+      return false;
+    v = items[h % cap];
+    head.store(h + 1);
+    return true;
+  }
+
+  // Block until there might be room to push or something to pop.
+  void waitRoom() { head.wait([this]() { return tail.load() - head.load() < cap; }); }
+  void waitItem() { tail.wait([this]() { return head.load() != tail.load(); }); }
+
+private:
+  std::unique_ptr<uint64_t[]> items;
+  uint32_t cap;
+  CSV_Counter head;
+  CSV_Counter tail;
+};
+
+// Invokes clb for every token of the row beginning at tk whose first delimiter
+// is idx[i], tk and i are left at the beginning of the following row.
+// A row without a newline is only possible at the very end of the file.
+template<typename G>
+void emitRow(Error& err, G& clb, const CSV_Batch& b, uint32_t row, size_t& tk, size_t& i) {
+  uint32_t column = 0;
+  for(; i < b.idx.size(); i++) {
+    uint32_t off = b.idx[i] & ~CSV_IndexNL;
+    CSVReader::Token token = spanToken(b.mem + tk, b.mem + off);
+    clb(err, row, column, token);
+    tk = off + 1;
+
+    if(b.idx[i] & CSV_IndexNL) {
+      i++;
+      return;
+    }
+    column++;
+  }
+
+  if(tk < b.len) {
+    CSVReader::Token token = spanToken(b.mem + tk, b.mem + b.len);
+    clb(err, row, column, token);
+    tk = b.len;
+  }
+}
+
+} // namespace csv
+} // namespace detail
+
+// Routes every row of every batch to one of the consumers.
+// With round robin whole batches are handed out in turn, with key hash the rows
+// are spread by the hash of their key column so equal keys meet the same consumer.
+// The router runs on the calling thread and stalls whenever the queue of the
+// consumer it routes to is full, stage 1 in turn stalls once every batch is taken.
+// Stalled threads and idle consumers sleep rather than spin, see CSV_Counter.
+// A batch is only handed back to stage 1 when every consumer is done with it,
+// since they finish out of order the router releases them in order as they do.
+template<typename F>
+Error& detail::csv::CSVPipeline::fanOut(Error& err, F& clb, uint32_t consumers, CSVReader::Routing routing, uint32_t key, uint32_t& row) {
+  bool hashed = routing == CSVReader::Routing::KeyHash;
+
+  std::vector<std::unique_ptr<CSV_BatchQueue>> queues;
+  std::unique_ptr<Error[]> errs(new Error[consumers]);
+  std::vector<std::thread> threads;
+  std::atomic<bool> abort(false);
+
+  for(uint32_t c = 0; c < consumers; c++) {
+    queues.emplace_back(new CSV_BatchQueue(count));
+  }
+
+  for(uint32_t c = 0; c < consumers; c++) {
+    threads.emplace_back([&, c]() {
+      CSV_ChunkForward<F> fwd(clb, c);
+      uint64_t n;
+
+      while(true) {
+        while(!queues[c]->tryPop(n)) {
+          queues[c]->waitItem();
+        }
+
+        if(n == UINT64_MAX)
+          break;
+
+        CSV_Batch& b = batches[n % count];
+        if(!abort) {
+          if(hashed) {
+            for(const CSV_RowRef& ref : b.routes[c]) {
+              size_t tk = ref.start;
+              size_t i = ref.idx;
+              emitRow(errs[c], fwd, b, ref.row, tk, i);
+            }
+          }
+          else {
+            size_t tk = b.first;
+            size_t i = 0;
+            for(uint32_t r = b.row; i < b.idx.size() || (b.last && tk < b.len); r++) {
+              emitRow(errs[c], fwd, b, r, tk, i);
+            }
+          }
+
+          if(!errs[c].peekOk())
+            abort = true;
+        }
+
+        // the router sleeps on produced, a batch it can release wakes it too.
+        b.refs.fetch_sub(1, std::memory_order_release);
+        produced.notify();
+      }
+    });
+  }
+
+  // batches are released up to the one being dispatched, never past the last
+  // one dispatched since the slots beyond it read as free as well.
+  uint64_t released = 0;
+  uint64_t dispatched = 0;
+  auto releasable = [&](uint64_t upto) {
+    return released < upto && batches[released % count].refs.load(std::memory_order_acquire) == 0;
+  };
+  auto release = [&](uint64_t upto) {
+    while(releasable(upto)) {
+      released++;
+    }
+    consumed.store(released);
+  };
+
+  auto dispatch = [&](uint32_t c, uint64_t n) {
+    while(!queues[c]->tryPush(n)) {
+      release(n == UINT64_MAX ? dispatched : n);
+      queues[c]->waitRoom();
+    }
+  };
+
+  std::hash<std::string_view> hasher;
+
+  for(uint64_t n = 0; !abort; n++) {
+    while(produced.load() <= n) {
+      release(n);
+      produced.wait([&]() { return produced.load() > n || releasable(n); });
+    }
+
+    CSV_Batch& b = batches[n % count];
+    b.row = row;
+
+    if(hashed) {
+      b.routes.resize(consumers);
+      for(std::vector<CSV_RowRef, StdAllocator<CSV_RowRef>>& r : b.routes) {
+        r.clear();
+      }
+
+      size_t tk = b.first;
+      size_t i = 0;
+      while(i < b.idx.size() || (b.last && tk < b.len)) {
+        CSV_RowRef ref{ row, (uint32_t)tk, (uint32_t)i };
+        std::string_view keytk;
+        uint32_t column = 0;
+        bool nl = false;
+
+        for(; i < b.idx.size() && !nl; i++) {
+          uint32_t off = b.idx[i] & ~CSV_IndexNL;
+          if(column == key)
+            keytk = spanToken(b.mem + tk, b.mem + off);
+          nl = b.idx[i] & CSV_IndexNL;
+          tk = off + 1;
+          column++;
+        }
+
+        if(!nl) {
+          if(column == key)
+            keytk = spanToken(b.mem + tk, b.mem + b.len);
+          tk = b.len;
+        }
+
+        b.routes[hasher(keytk) % consumers].push_back(ref);
+        row += nl;
+      }
+
+      b.refs.store(consumers, std::memory_order_relaxed);
+      for(uint32_t c = 0; c < consumers; c++) {
+        dispatch(c, n);
+      }
+    }
+    else {
+      for(uint32_t e : b.idx) {
+        row += e >> 31;
+      }
+
+      b.refs.store(1, std::memory_order_relaxed);
+      dispatch((uint32_t)(n % consumers), n);
+    }
+    dispatched = n + 1;
+
+    if(b.last)
+      break;
+  }
+
+  for(uint32_t c = 0; c < consumers; c++) {
+    dispatch(c, UINT64_MAX);
+  }
+
+  for(std::thread& t : threads) {
+    t.join();
+  }
+
+  for(uint32_t c = 0; c < consumers; c++) {
+    if(!errs[c].peekOk()) {
+      if(err.peekOk())
+        err.raise(errs[c].getCode(), errs[c].getPath(), errs[c].getLine(), "{}", errs[c].getMsg());
+      errs[c].reset();
+    }
+  }
+
+  if(!ioerr.peekOk()) {
+    if(err.peekOk())
+      err.raise(ioerr.getCode(), ioerr.getPath(), ioerr.getLine(), "{}", ioerr.getMsg());
+    ioerr.reset();
+  }
+
+  return err;
+}
+
+// Parses the file and hands the rows to consumers threads, see CSVPipeline::fanOut.
+// The callback is invoked from the consumer threads with the consumer index in
+// place of the chunk of a ChunkCallback and must as such be thread safe.
+// The pipeline depth sets the amount of batches in flight, at least two per consumer.
+template<typename F>
+Error& CSVReader::readFanOut(Error& err, F& clb, uint32_t consumers, Routing routing, uint32_t key) {
+  namespace dcsv = detail::csv;
+
+  if(!err.peekOk())
+    return err;
+
+  if(!reader.isOpen()) {
+    WK_RAISE_ERR(err, NotOpen, "CSVReader: no file open to read");
+    return err;
+  }
+
+  if(consumers == 0)
+    consumers = 1;
+
+  uint32_t depth = consumers * 2 > pipeline_depth ? consumers * 2 : pipeline_depth;
+  dcsv::CSVPipeline pipe(reader, req_alignment, depth, seperator, dcsv::selectIndex(), true);
+  return pipe.fanOut(err, clb, consumers, routing, key, row);
+}
+
+} // namespace Wikinger
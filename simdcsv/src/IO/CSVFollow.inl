@@ -0,0 +1,97 @@
+#include "FileWatch.h"
+
+namespace Wikinger {
+
+// Parses the file and keeps on parsing whatever is appended to it until stop
+// is set, rows are delivered as soon as they are complete.
+// Once the end of the file is reached it waits for the directory of the file
+// to change, or for poll_ms milliseconds where that cannot be waited on.
+// The push parser keeps the unfinished row and the quote and escape carries
+// between reads, so every read resumes where the last one stopped.
+// A file which is truncated below what has been read is read again from the
+// beginning, the unfinished row is dropped. A file which has been replaced,
+// as when logs are rotated, has its last row flushed before the new file is
+// read from the beginning. Rows of a new file are numbered from zero.
+template<typename F>
+Error& CSVReader::follow(Error& err, F& clb, const std::atomic<bool>& stop, uint32_t poll_ms) {
+  if(!err.peekOk())
+    return err;
+
+  if(!reader.isOpen()) {
+    WK_RAISE_ERR(err, NotOpen, "CSVReader: no file open to read");
+    return err;
+  }
+
+  // without notifications the wait degrades to polling.
+  FileWatch watch;
+  Error werr;
+  watch.open(werr, path);
+  if(!werr.isOk())
+    WK_DEBUG("CSVReader: following '{}' by polling", path);
+
+  CSVPushParser parser(seperator);
+  parser.setLatency(1, 0);
+  detail::csv::CSV_RowOffset<F> fwd(clb, row);
+
+  size_t size = 1024 * 1024;
+  size = (1 + (size - 1) / req_alignment) * req_alignment;
+  char* buf = (char*)getAllocator().allocate(size, req_alignment);
+
+  int64_t offset = reader.tell();
+
+  // feeds what has been appended past offset, returns whether the read was full.
+  auto pull = [&](bool& fed) {
+    // unbuffered reads have to begin on an aligned offset.
+    int64_t aligned = offset - offset % req_alignment;
+    size_t skip = (size_t)(offset - aligned);
+    reader.seek(err, aligned, Whence::Begin);
+    size_t read = reader.readbin(err, buf, size);
+
+    fed = read > skip;
+    if(fed) {
+      parser.feed(err, fwd, buf + skip, read - skip);
+      offset += read - skip;
+    }
+    return read == size;
+  };
+
+  while(!stop.load(std::memory_order_relaxed) && err.peekOk()) {
+    bool fed;
+    if(pull(fed) && fed)
+      continue;
+
+    // caught up with the writer, the file is checked before waiting on it.
+    UnbufferedFileReader current;
+    Error oerr;
+    current.open(oerr, path);
+    bool replaced = oerr.isOk() && current.getFileId() != reader.getFileId();
+    current.close();
+
+    if(replaced) {
+      // the writer may have appended to the old file before it was rotated,
+      // it is read to its end before the last row is taken as complete.
+      while(err.peekOk() && (pull(fed) || fed));
+      parser.finish(err, fwd);
+      reader.close();
+      reader.open(err, path);
+      fwd.base = 0;
+      offset = 0;
+    }
+    else if(reader.size(err) < offset) {
+      parser.reset();
+      fwd.base = 0;
+      offset = 0;
+    }
+    else {
+      watch.wait(poll_ms);
+    }
+  }
+
+  getAllocator().deallocate(buf, size, req_alignment);
+
+  row = fwd.base + parser.getRow();
+  column = 0;
+  return err;
+}
+
+} // namespace Wikinger
@@ -0,0 +1,348 @@
+#include "Fileinfo.h"
+
+#include <cstdio>
+
+namespace Wikinger {
+
+// The offsets of every stride-th row start of a file, row 0 included.
+// A row is found by seeking to the nearest indexed row before it and parsing
+// at most stride - 1 rows more, smaller strides trade memory for less parsing.
+// The index is stamped with the size and modification time of the file it was
+// built from and can be saved to and loaded from a sidecar file, which is the
+// header below followed by the offsets as they are kept in memory so that it
+// can just as well be mapped.
+class CSVRowIndex {
+public:
+  CSVRowIndex() : stride(0), size(0), mtime(0), rows(0) {}
+
+  Error& save(Error& err, const Filepath& file) const;
+  Error& load(Error& err, const Filepath& file);
+
+  // Returns whether the index was built from the file as it is now.
+  bool matches(const Fileinfo& info) const;
+
+  static Filepath getSidecar(const Filepath& csv);
+
+  uint32_t getStride() const { return stride; }
+  uint64_t getRowCount() const { return rows; }
+
+private:
+  friend class CSVReader;
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t stride;
+    uint64_t size;
+    uint64_t mtime;
+    uint64_t rows;
+    uint64_t count;
+  };
+
+  uint32_t stride;
+  uint64_t size;
+  uint64_t mtime;
+  uint64_t rows;
+  std::vector<uint64_t, StdAllocator<uint64_t>> offsets;
+};
+
+namespace detail {
+namespace csv {
+
+constexpr char CSV_IndexMagic[8] = { 'W', 'K', 'C', 'S', 'V', 'I', 'D', 'X' };
+constexpr uint32_t CSV_IndexVersion = 1;
+
+// fopen is deprecated by the msvc crt, the sidecar files go through here.
+inline FILE* openSidecar(const Filepath& file, const char* mode) {
+  FILE* f = nullptr;
+#ifdef _WIN32
+  if(fopen_s(&f, file.getPtr(), mode) != 0)
+    return nullptr;
+#else
+  f = fopen(file.getPtr(), mode);
+#endif
+  return f;
+}
+
+// Records the offset of every stride-th row start and counts the rows.
+// Only the newlines outside of quotes are needed so this is the mask stage
+// alone, whole blocks without a recorded row are skipped with a popcount.
+template<masksSig masks, tzcntSig tzcnt, andnSig andn, popcntSig popcnt>
+void indexRows(Error& err, UnbufferedFileReader& file, size_t alignment, char seperator, uint32_t stride, std::vector<uint64_t, StdAllocator<uint64_t>>& offsets, uint64_t& rows) {
+  uint32_t row = 0;
+  uint32_t column = 0;
+  CSV_Context ctx(row, column);
+
+  size_t size = 1024 * 1024;
+  size = (1 + (size - 1) / alignment) * alignment;
+  char* buf = (char*)getAllocator().allocate(size + 64, alignment);
+
+  offsets.clear();
+  offsets.push_back(0);
+
+  // the row beginning after the n-th newline is row n.
+  uint64_t n = 0;
+  uint64_t next = stride;
+  uint64_t pos = 0;
+  bool open = false;
+
+  file.seek(err, 0, Whence::Begin);
+
+  size_t read;
+  do {
+    read = file.readbin(err, buf, size);
+
+    for(size_t i = 0; i < read; i += 64) {
+      masks(ctx, buf + i, seperator);
+      uint64_t fill = quoteFill<andn>(ctx, read - i);
+      uint64_t nl = andn(fill, ctx.nl_mask);
+      uint64_t cnt = popcnt(nl);
+
+      while(n + cnt >= next) {
+        for(uint64_t k = next - n - 1; k > 0; k--) {
+          nl &= nl - 1;
+        }
+        cnt -= next - n;
+        n = next;
+        offsets.push_back(pos + i + tzcnt(nl) + 1);
+        nl &= nl - 1;
+        next += stride;
+      }
+      n += cnt;
+
+      if(i + 64 >= read)
+        open = !((andn(fill, ctx.nl_mask) >> (read - 1 - i)) & 1);
+    }
+
+    pos += read;
+  } while(read == size && err.peekOk());
+
+  getAllocator().deallocate(buf, size + 64, alignment);
+
+  // a row start at the very end of the file begins no row.
+  if(offsets.size() > 1 && offsets.back() >= pos)
+    offsets.pop_back();
+
+  rows = n + (pos > 0 && open ? 1 : 0);
+}
+
+// Forwards the rows in [first, last) to the callback, base is the row
+// the parse began at.
+template<typename F>
+class CSV_RowWindow {
+public:
+  CSV_RowWindow(F& f, uint64_t b, uint64_t fst, uint64_t lst) :
+    clb(f), base(b), first(fst), last(lst) {}
+
+  void operator()(Error& err, uint32_t row, uint32_t col, CSVReader::Token& tk) {
+    uint64_t r = base + row;
+    if(r >= first && r < last)
+      clb(err, (uint32_t)r, col, tk);
+  }
+
+private:
+  F& clb;
+  uint64_t base;
+  uint64_t first;
+  uint64_t last;
+};
+
+} // namespace csv
+} // namespace detail
+
+Filepath CSVRowIndex::getSidecar(const Filepath& csv) {
+  std::string p = csv;
+  p += ".idx";
+  return Filepath(std::string_view(p));
+}
+
+bool CSVRowIndex::matches(const Fileinfo& info) const {
+  return stride != 0 && info.size == size && info.mtime == mtime;
+}
+
+Error& CSVRowIndex::save(Error& err, const Filepath& file) const {
+  if(!err.peekOk())
+    return err;
+
+  FILE* f = detail::csv::openSidecar(file, "wb");
+  if(f == nullptr) {
+    WK_RAISE_ERR(err, CannotOpen, "CSVRowIndex: Couldn't create '{}'", file);
+    return err;
+  }
+
+  Header h;
+  memcpy(h.magic, detail::csv::CSV_IndexMagic, sizeof(h.magic));
+  h.version = detail::csv::CSV_IndexVersion;
+  h.stride = stride;
+  h.size = size;
+  h.mtime = mtime;
+  h.rows = rows;
+  h.count = offsets.size();
+
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  ok = ok && fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), f) == offsets.size();
+  ok = fclose(f) == 0 && ok;
+
+  if(!ok)
+    WK_RAISE_ERR(err, ReaderWriter_Write, "CSVRowIndex: Couldn't write '{}'", file);
+  return err;
+}
+
+Error& CSVRowIndex::load(Error& err, const Filepath& file) {
+  if(!err.peekOk())
+    return err;
+
+  FILE* f = detail::csv::openSidecar(file, "rb");
+  if(f == nullptr) {
+    WK_RAISE_ERR(err, CannotOpen, "CSVRowIndex: Couldn't open '{}'", file);
+    return err;
+  }
+
+  Header h;
+  bool ok = fread(&h, sizeof(h), 1, f) == 1;
+  ok = ok && memcmp(h.magic, detail::csv::CSV_IndexMagic, sizeof(h.magic)) == 0;
+  ok = ok && h.version == detail::csv::CSV_IndexVersion && h.stride != 0 && h.count != 0;
+
+  if(ok) {
+    offsets.resize(h.count);
+    ok = fread(offsets.data(), sizeof(uint64_t), h.count, f) == h.count;
+  }
+  fclose(f);
+
+  if(!ok) {
+    stride = 0;
+    offsets.clear();
+    WK_RAISE_ERR(err, InvalidFormat, "CSVRowIndex: '{}' is not a row index", file);
+    return err;
+  }
+
+  stride = h.stride;
+  size = h.size;
+  mtime = h.mtime;
+  rows = h.rows;
+  return err;
+}
+
+// Builds the row index of the open file in a pass of its own, the file is left
+// positioned at its beginning.
+Error& CSVReader::buildIndex(Error& err, CSVRowIndex& index, uint32_t stride) {
+  namespace dcsv = detail::csv;
+
+  if(!err.peekOk())
+    return err;
+
+  if(!reader.isOpen()) {
+    WK_RAISE_ERR(err, NotOpen, "CSVReader: no file open to read");
+    return err;
+  }
+
+  static RuntimeDispatch<void(Error&, UnbufferedFileReader&, size_t, char, uint32_t, std::vector<uint64_t, StdAllocator<uint64_t>>&, uint64_t&)> dispatch{
+    { dcsv::indexRows<dcsv::masks_AVX2, dcsv::tzcnt_bmi, dcsv::andn_bmi, dcsv::popcnt_abm>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 | CPU::ISA::popcnt },
+    { dcsv::indexRows<dcsv::masks_SSE2, dcsv::tzcnt_bmi, dcsv::andn_bmi, dcsv::popcnt_abm>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 | CPU::ISA::popcnt },
+    { dcsv::indexRows<dcsv::masks_x64, dcsv::tzcnt_bmi, dcsv::andn_bmi, dcsv::popcnt_abm>, CPU::ISA::bmi1 | CPU::ISA::popcnt },
+    { dcsv::indexRows<dcsv::masks_AVX2, dcsv::tzcnt_x64, dcsv::andn_x64, dcsv::popcnt_x64>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { dcsv::indexRows<dcsv::masks_SSE2, dcsv::tzcnt_x64, dcsv::andn_x64, dcsv::popcnt_x64>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { dcsv::indexRows<dcsv::masks_x64, dcsv::tzcnt_x64, dcsv::andn_x64, dcsv::popcnt_x64>, 0 }
+  };
+
+  Fileinfo info;
+  stat(info, path);
+
+  index.stride = stride == 0 ? 1 : stride;
+  index.size = info.size;
+  index.mtime = info.mtime;
+  dispatch(err, reader, req_alignment, seperator, index.stride, index.offsets, index.rows);
+
+  reader.seek(err, 0, Whence::Begin);
+  return err;
+}
+
+// Loads the sidecar index of the open file, when there is none or it is out of
+// date the index is built and saved again. Failing to save is not an error,
+// the index is merely rebuilt next time.
+Error& CSVReader::loadIndex(Error& err, CSVRowIndex& index, uint32_t stride) {
+  if(!err.peekOk())
+    return err;
+
+  Filepath sidecar = CSVRowIndex::getSidecar(path);
+  Fileinfo info;
+  stat(info, path);
+
+  Error lerr;
+  index.load(lerr, sidecar);
+  if(lerr.isOk() && index.matches(info) && (stride == 0 || index.stride == stride))
+    return err;
+
+  buildIndex(err, index, stride == 0 ? 1024 : stride);
+
+  Error serr;
+  index.save(serr, sidecar);
+  if(!serr.isOk())
+    WK_DEBUG("CSVReader: Couldn't save the row index of '{}'", path);
+
+  return err;
+}
+
+// Parses the rows [first, last) of the file, the rows keep their numbers in the file.
+// Only the rows between the indexed rows around the range are read.
+template<typename F>
+Error& CSVReader::getRange(Error& err, F& clb, const CSVRowIndex& index, uint64_t first, uint64_t last) {
+  namespace dcsv = detail::csv;
+
+  if(!err.peekOk())
+    return err;
+
+  if(!reader.isOpen()) {
+    WK_RAISE_ERR(err, NotOpen, "CSVReader: no file open to read");
+    return err;
+  }
+
+  static RuntimeDispatch<Error&(Error&, dcsv::CSV_RowWindow<F>&, uint32_t&, uint32_t&, char, dcsv::CSVFileReader&)> dispatch{
+    { dcsv::readCSV_AVX2<false, dcsv::tzcnt_bmi, dcsv::andn_bmi, dcsv::CSV_RowWindow<F>>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 },
+    { dcsv::readCSV_SSE2<false, dcsv::tzcnt_bmi, dcsv::andn_bmi, dcsv::CSV_RowWindow<F>>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 },
+    { dcsv::readCSV_bmi1<false, dcsv::tzcnt_bmi, dcsv::andn_bmi, dcsv::CSV_RowWindow<F>>, CPU::ISA::bmi1 },
+    { dcsv::readCSV_AVX2<false, dcsv::tzcnt_x64, dcsv::andn_x64, dcsv::CSV_RowWindow<F>>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { dcsv::readCSV_SSE2<false, dcsv::tzcnt_x64, dcsv::andn_x64, dcsv::CSV_RowWindow<F>>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { dcsv::readCSV_bmi1<false, dcsv::tzcnt_x64, dcsv::andn_x64, dcsv::CSV_RowWindow<F>>, 0 }
+  };
+
+  // a rewrite of the same size moves the rows as well, the mtime is compared too.
+  Fileinfo info;
+  stat(info, path);
+  if(!index.matches(info)) {
+    WK_RAISE_ERR(err, InvalidFormat, "CSVReader: the row index does not belong to '{}'", path);
+    return err;
+  }
+
+  last = last < index.rows ? last : index.rows;
+  if(first >= last)
+    return err;
+
+  uint64_t k = first / index.stride;
+  uint64_t kend = (last + index.stride - 1) / index.stride;
+  int64_t begin = (int64_t)index.offsets[k];
+  int64_t end = kend < index.offsets.size() ? (int64_t)index.offsets[kend] : (int64_t)info.size;
+
+  // the range counts from the indexed row, the counters of the reader are
+  // put back afterwards so that the rows of a read in progress keep their numbers.
+  uint32_t saved_row = row;
+  uint32_t saved_column = column;
+  row = 0;
+  column = 0;
+
+  dcsv::CSV_RowWindow<F> window(clb, k * index.stride, first, last);
+  dcsv::CSVFileReader cread(reader, req_alignment);
+  cread.setRange(err, begin, end);
+  dispatch(err, window, row, column, seperator, cread);
+
+  row = saved_row;
+  column = saved_column;
+  return err;
+}
+
+template<typename F>
+Error& CSVReader::getRow(Error& err, F& clb, const CSVRowIndex& index, uint64_t n) {
+  return getRange(err, clb, index, n, n + 1);
+}
+
+} // namespace Wikinger
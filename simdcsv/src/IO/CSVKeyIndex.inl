@@ -0,0 +1,295 @@
+#include <algorithm>
+
+namespace Wikinger {
+
+// Maps the hash of a key column to the rows holding it, for point lookups.
+// Rows are added during a pass over CSVReader::rows, which may just as well
+// be the pass consuming the file, and the table is sorted by hash once done.
+// A lookup finds the matching rows with a binary search in memory and reads
+// each of them with a single read at its offset, rows whose key merely
+// collides are dropped after reading.
+// The sidecar is the header followed by the sorted entries.
+class CSVKeyIndex {
+public:
+  CSVKeyIndex(uint32_t column = 0) : column(column), size(0), mtime(0) {}
+
+  void add(const CSVRow& row);
+  void finish(const Fileinfo& info);
+
+  Error& save(Error& err, const Filepath& file) const;
+  Error& load(Error& err, const Filepath& file);
+
+  bool matches(const Fileinfo& info) const;
+
+  static Filepath getSidecar(const Filepath& csv, uint32_t column);
+  static uint64_t hash(std::string_view key);
+
+  uint32_t getColumn() const { return column; }
+  size_t getKeyCount() const { return entries.size(); }
+
+private:
+  friend class CSVReader;
+
+  struct Entry {
+    uint64_t hash;
+    int64_t offset;
+    uint64_t row;
+  };
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t column;
+    uint64_t size;
+    uint64_t mtime;
+    uint64_t count;
+  };
+
+  uint32_t column;
+  uint64_t size;
+  uint64_t mtime;
+  std::vector<Entry, StdAllocator<Entry>> entries;
+};
+
+namespace detail {
+namespace csv {
+
+constexpr char CSV_KeyIndexMagic[8] = { 'W', 'K', 'C', 'S', 'V', 'K', 'E', 'Y' };
+constexpr uint32_t CSV_KeyIndexVersion = 1;
+
+// Loads the row beginning at offset at into the chunk and returns its length,
+// the first read is small since most rows fit in a single sector.
+template<masksSig masks, tzcntSig tzcnt, andnSig andn>
+size_t loadRow(Error& err, UnbufferedFileReader& file, CSV_Chunk& ck, int64_t at, char seperator, size_t alignment) {
+  size_t window = 1024 * 4;
+  window = (1 + (window - 1) / alignment) * alignment;
+
+  int64_t pos = at - at % alignment;
+  loadChunk(err, file, ck, pos, at, window, alignment, 0);
+
+  char* term = findRowEnd<masks, tzcnt, andn>(err, file, ck, 0, 0, seperator, alignment);
+  return term - ck.data;
+}
+
+} // namespace csv
+} // namespace detail
+
+// The hash has to stay the same across builds since it is persisted, this is 64 bit FNV-1a.
+uint64_t CSVKeyIndex::hash(std::string_view key) {
+  uint64_t h = 0xcbf29ce484222325;
+  for(char c : key) {
+    h ^= (uint8_t)c;
+    h *= 0x100000001b3;
+  }
+  return h;
+}
+
+void CSVKeyIndex::add(const CSVRow& row) {
+  if(column >= row.size())
+    return;
+
+  Error err;
+  std::string_view key = row[column].get<std::string_view>(err);
+  entries.push_back(Entry{ hash(key), row.getOffset(), row.getRow() });
+}
+
+// Sorts the entries and stamps the index with the file they were added from.
+void CSVKeyIndex::finish(const Fileinfo& info) {
+  std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+    return a.hash < b.hash || (a.hash == b.hash && a.offset < b.offset);
+  });
+  size = info.size;
+  mtime = info.mtime;
+}
+
+bool CSVKeyIndex::matches(const Fileinfo& info) const {
+  return info.size == size && info.mtime == mtime;
+}
+
+Filepath CSVKeyIndex::getSidecar(const Filepath& csv, uint32_t column) {
+  std::string p = csv;
+  p += ".key" + std::to_string(column) + ".idx";
+  return Filepath(std::string_view(p));
+}
+
+Error& CSVKeyIndex::save(Error& err, const Filepath& file) const {
+  if(!err.peekOk())
+    return err;
+
+  FILE* f = detail::csv::openSidecar(file, "wb");
+  if(f == nullptr) {
+    WK_RAISE_ERR(err, CannotOpen, "CSVKeyIndex: Couldn't create '{}'", file);
+    return err;
+  }
+
+  Header h;
+  memcpy(h.magic, detail::csv::CSV_KeyIndexMagic, sizeof(h.magic));
+  h.version = detail::csv::CSV_KeyIndexVersion;
+  h.column = column;
+  h.size = size;
+  h.mtime = mtime;
+  h.count = entries.size();
+
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  ok = ok && fwrite(entries.data(), sizeof(Entry), entries.size(), f) == entries.size();
+  ok = fclose(f) == 0 && ok;
+
+  if(!ok)
+    WK_RAISE_ERR(err, ReaderWriter_Write, "CSVKeyIndex: Couldn't write '{}'", file);
+  return err;
+}
+
+Error& CSVKeyIndex::load(Error& err, const Filepath& file) {
+  if(!err.peekOk())
+    return err;
+
+  FILE* f = detail::csv::openSidecar(file, "rb");
+  if(f == nullptr) {
+    WK_RAISE_ERR(err, CannotOpen, "CSVKeyIndex: Couldn't open '{}'", file);
+    return err;
+  }
+
+  Header h;
+  bool ok = fread(&h, sizeof(h), 1, f) == 1;
+  ok = ok && memcmp(h.magic, detail::csv::CSV_KeyIndexMagic, sizeof(h.magic)) == 0;
+  ok = ok && h.version == detail::csv::CSV_KeyIndexVersion;
+
+  if(ok) {
+    entries.resize(h.count);
+    ok = fread(entries.data(), sizeof(Entry), h.count, f) == h.count;
+  }
+  fclose(f);
+
+  if(!ok) {
+    entries.clear();
+    WK_RAISE_ERR(err, InvalidFormat, "CSVKeyIndex: '{}' is not a key index", file);
+    return err;
+  }
+
+  column = h.column;
+  size = h.size;
+  mtime = h.mtime;
+  return err;
+}
+
+// Builds the key index in a pass of its own, the file is left at its beginning.
+// To build it while consuming the file add every row to the index instead.
+Error& CSVReader::buildKeyIndex(Error& err, CSVKeyIndex& index) {
+  if(!err.peekOk())
+    return err;
+
+  reader.seek(err, 0, Whence::Begin);
+  row = 0;
+  column = 0;
+
+  index.entries.clear();
+  for(const CSVRow& r : rows(err)) {
+    index.add(r);
+  }
+
+  Fileinfo info;
+  stat(info, path);
+  index.finish(info);
+
+  reader.seek(err, 0, Whence::Begin);
+  row = 0;
+  return err;
+}
+
+// Loads the sidecar key index of the open file, or builds and saves it when
+// there is none or it is out of date.
+Error& CSVReader::loadKeyIndex(Error& err, CSVKeyIndex& index) {
+  if(!err.peekOk())
+    return err;
+
+  Filepath sidecar = CSVKeyIndex::getSidecar(path, index.column);
+  Fileinfo info;
+  stat(info, path);
+
+  uint32_t col = index.column;
+  Error lerr;
+  index.load(lerr, sidecar);
+  if(lerr.isOk() && index.column == col && index.matches(info))
+    return err;
+
+  index.column = col;
+  buildKeyIndex(err, index);
+
+  Error serr;
+  index.save(serr, sidecar);
+  if(!serr.isOk())
+    WK_DEBUG("CSVReader: Couldn't save the key index of '{}'", path);
+
+  return err;
+}
+
+// Invokes the callback for the tokens of every row whose key column equals key,
+// the rows keep their numbers in the file.
+template<typename F>
+Error& CSVReader::lookup(Error& err, F& clb, const CSVKeyIndex& index, std::string_view key) {
+  namespace dcsv = detail::csv;
+
+  if(!err.peekOk())
+    return err;
+
+  if(!reader.isOpen()) {
+    WK_RAISE_ERR(err, NotOpen, "CSVReader: no file open to read");
+    return err;
+  }
+
+  static RuntimeDispatch<size_t(Error&, UnbufferedFileReader&, dcsv::CSV_Chunk&, int64_t, char, size_t)> dispatchLoad{
+    { dcsv::loadRow<dcsv::masks_AVX2, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 },
+    { dcsv::loadRow<dcsv::masks_SSE2, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 },
+    { dcsv::loadRow<dcsv::masks_x64, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::bmi1 },
+    { dcsv::loadRow<dcsv::masks_AVX2, dcsv::tzcnt_x64, dcsv::andn_x64>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { dcsv::loadRow<dcsv::masks_SSE2, dcsv::tzcnt_x64, dcsv::andn_x64>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { dcsv::loadRow<dcsv::masks_x64, dcsv::tzcnt_x64, dcsv::andn_x64>, 0 }
+  };
+
+  // a rewrite of the same size moves the rows as well, the mtime is compared too.
+  Fileinfo info;
+  stat(info, path);
+  if(!index.matches(info)) {
+    WK_RAISE_ERR(err, InvalidFormat, "CSVReader: the key index does not belong to '{}'", path);
+    return err;
+  }
+
+  uint64_t h = CSVKeyIndex::hash(key);
+  auto it = std::lower_bound(index.entries.begin(), index.entries.end(), h, [](const CSVKeyIndex::Entry& e, uint64_t v) {
+    return e.hash < v;
+  });
+
+  dcsv::indexSig* tokenize = dcsv::selectIndex();
+  dcsv::CSV_Chunk ck;
+  std::vector<uint32_t, StdAllocator<uint32_t>> idx;
+  uint32_t r = 0;
+  uint32_t c = 0;
+
+  for(; it != index.entries.end() && it->hash == h && err.peekOk(); ++it) {
+    size_t len = dispatchLoad(err, reader, ck, it->offset, seperator, req_alignment);
+
+    dcsv::CSV_Context ctx(r, c);
+    idx.clear();
+    tokenize(ctx, ck.data, 0, len, true, seperator, idx);
+
+    size_t n = idx.size();
+    size_t end = len;
+    if(n > 0 && (idx[n - 1] & dcsv::CSV_IndexNL)) {
+      n--;
+      end = idx[n] & ~dcsv::CSV_IndexNL;
+    }
+
+    CSVRow found(ck.data, idx.data(), (uint32_t)n, 0, end, (uint32_t)it->row, it->offset);
+    if(index.column >= found.size() || found[index.column].get<std::string_view>(err) != key)
+      continue;
+
+    for(size_t col = 0; col < found.size() && err.peekOk(); col++) {
+      CSVReader::Token tk = found[col];
+      clb(err, (uint32_t)it->row, (uint32_t)col, tk);
+    }
+  }
+
+  return err;
+}
+
+} // namespace Wikinger
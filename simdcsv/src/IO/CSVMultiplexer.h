@@ -0,0 +1,82 @@
+#ifndef WK_CSVMULTIPLEXER_H
+#define WK_CSVMULTIPLEXER_H
+
+#include "CSVReader.h"
+
+#include <vector>
+
+namespace Wikinger {
+namespace detail {
+namespace csv {
+
+// Set as the buffer of a stream which does not hold one.
+constexpr uint32_t CSV_NoBuffer = 0xffffffff;
+
+// The parse state of a single stream, everything else is shared among them.
+// An idle stream without an unfinished token does not hold a buffer.
+struct CSV_Stream {
+  uint64_t quote_carry;
+  uint64_t esc_carry;
+  uint32_t row;
+  uint32_t column;
+
+  // The pooled buffer holding the unfinished token followed by the data
+  // not indexed yet, the last pending bytes of it. newline tells whether a
+  // newline has been pushed since the stream was last parsed.
+  uint32_t buf;
+  uint32_t pending;
+  bool newline;
+
+  bool open;
+  bool queued;
+};
+
+} // namespace csv
+} // namespace detail
+
+class CSVMultiplexer {
+public:
+  CSVMultiplexer(char seperator = ',');
+
+  uint32_t open();
+  template<typename F>
+  Error& close(Error& err, F& clb, uint32_t stream);
+
+  Error& push(Error& err, uint32_t stream, const char* data, size_t len);
+  template<typename F>
+  Error& poll(Error& err, F& clb);
+
+  char getSep() const;
+  void setSep(char s);
+
+  size_t getStreamCount() const;
+  size_t getPooledBuffers() const;
+
+private:
+  template<typename F>
+  void parse(Error& err, F& clb, uint32_t stream, bool last);
+
+  uint32_t acquire();
+  void release(detail::csv::CSV_Stream& s);
+
+  char seperator;
+  uint32_t row;
+  uint32_t column;
+  detail::csv::CSV_Context ctx;
+  detail::csv::indexSig* index;
+
+  std::vector<detail::csv::CSV_Stream> streams;
+  std::vector<uint32_t, StdAllocator<uint32_t>> closed;
+  std::vector<uint32_t, StdAllocator<uint32_t>> ready;
+
+  std::vector<std::vector<char, StdAllocator<char>>> pool;
+  std::vector<uint32_t, StdAllocator<uint32_t>> unused;
+
+  std::vector<uint32_t, StdAllocator<uint32_t>> idx;
+};
+
+}
+
+#include "CSVMultiplexer.inl"
+
+#endif// WK_CSVMULTIPLEXER_H
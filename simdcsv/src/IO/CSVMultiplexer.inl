@@ -0,0 +1,202 @@
+namespace Wikinger {
+
+// Parses many streams which each receive little data on a single thread.
+// push() only copies the data into the stream's buffer, poll() then runs every
+// stream that received data through the kernel in one go. The context and the
+// index are shared, only the carries and the position are kept per stream and
+// the buffers for unfinished tokens are taken from a pool and handed back
+// as soon as a stream has no unfinished token left.
+// The callback has the signature of a CSVReader::ChunkCallback with the stream
+// in place of the chunk.
+CSVMultiplexer::CSVMultiplexer(char sep) :
+  seperator(sep), row(0), column(0), ctx(row, column),
+  index(detail::csv::selectIndex()) {}
+
+// Stream ids of closed streams are handed out again.
+uint32_t CSVMultiplexer::open() {
+  uint32_t id;
+  if(!closed.empty()) {
+    id = closed.back();
+    closed.pop_back();
+  }
+  else {
+    id = (uint32_t)streams.size();
+    streams.emplace_back();
+  }
+
+  detail::csv::CSV_Stream& s = streams[id];
+  s.quote_carry = 0;
+  s.esc_carry = 0;
+  s.row = 0;
+  s.column = 0;
+  s.buf = detail::csv::CSV_NoBuffer;
+  s.pending = 0;
+  s.newline = false;
+  s.open = true;
+  s.queued = false;
+  return id;
+}
+
+Error& CSVMultiplexer::push(Error& err, uint32_t stream, const char* data, size_t len) {
+  if(!err.peekOk())
+    return err;
+
+  if(stream >= streams.size() || !streams[stream].open) {
+    WK_RAISE_ERR(err, NotOpen, "CSVMultiplexer: stream {} is not open", stream);
+    return err;
+  }
+
+  detail::csv::CSV_Stream& s = streams[stream];
+  if(len == 0)
+    return err;
+
+  if(s.buf == detail::csv::CSV_NoBuffer)
+    s.buf = acquire();
+
+  std::vector<char, StdAllocator<char>>& b = pool[s.buf];
+  b.insert(b.end(), data, data + len);
+  s.pending += (uint32_t)len;
+  s.newline = s.newline || memchr(data, '\n', len) != nullptr;
+
+  if(!s.queued && (s.pending >= 64 || s.newline)) {
+    s.queued = true;
+    ready.push_back(stream);
+  }
+
+  return err;
+}
+
+// Parses the whole blocks of every stream pushed to since the last poll, the
+// rest as well when a newline arrived in it so that a short row on a slow
+// stream is not held back. Otherwise the rest waits for more data or for the
+// stream to be closed.
+template<typename F>
+Error& CSVMultiplexer::poll(Error& err, F& clb) {
+  for(size_t i = 0; i < ready.size() && err.peekOk(); i++) {
+    streams[ready[i]].queued = false;
+    parse(err, clb, ready[i], false);
+  }
+  ready.clear();
+  return err;
+}
+
+// Flushes whatever is left of the stream, its last token included.
+template<typename F>
+Error& CSVMultiplexer::close(Error& err, F& clb, uint32_t stream) {
+  if(stream >= streams.size() || !streams[stream].open) {
+    if(err.peekOk())
+      WK_RAISE_ERR(err, NotOpen, "CSVMultiplexer: stream {} is not open", stream);
+    return err;
+  }
+
+  detail::csv::CSV_Stream& s = streams[stream];
+  if(s.buf != detail::csv::CSV_NoBuffer && err.peekOk())
+    parse(err, clb, stream, true);
+
+  release(s);
+  s.pending = 0;
+  s.open = false;
+  closed.push_back(stream);
+  return err;
+}
+
+template<typename F>
+void CSVMultiplexer::parse(Error& err, F& clb, uint32_t stream, bool last) {
+  namespace dcsv = detail::csv;
+
+  dcsv::CSV_Stream& s = streams[stream];
+  if(s.buf == detail::csv::CSV_NoBuffer)
+    return;
+
+  std::vector<char, StdAllocator<char>>& b = pool[s.buf];
+  size_t len = b.size();
+  size_t from = len - s.pending;
+  size_t to = last || s.newline ? len : from + s.pending / 64 * 64;
+
+  row = s.row;
+  column = s.column;
+  ctx.quote_carry = s.quote_carry;
+  ctx.esc_carry = s.esc_carry;
+
+  // the masks always load whole blocks.
+  b.resize(len + 64);
+  idx.clear();
+  index(ctx, b.data(), from, to, to == len, seperator, idx);
+  b.resize(len);
+
+  size_t tk = 0;
+  for(size_t i = 0; i < idx.size() && err.peekOk(); i++) {
+    size_t off = idx[i] & ~dcsv::CSV_IndexNL;
+    CSVReader::Token token = dcsv::spanToken(b.data() + tk, b.data() + off);
+    clb(err, stream, row, column, token);
+
+    if(idx[i] & dcsv::CSV_IndexNL) {
+      row++;
+      column = 0;
+    }
+    else {
+      column++;
+    }
+    tk = off + 1;
+  }
+
+  if(last && tk < len && err.peekOk()) {
+    CSVReader::Token token = dcsv::spanToken(b.data() + tk, b.data() + len);
+    clb(err, stream, row, column, token);
+    tk = len;
+  }
+
+  s.row = row;
+  s.column = column;
+  s.quote_carry = ctx.quote_carry;
+  s.esc_carry = ctx.esc_carry;
+  s.pending = (uint32_t)(len - to);
+  s.newline = false;
+
+  b.erase(b.begin(), b.begin() + tk);
+  if(b.empty())
+    release(s);
+}
+
+uint32_t CSVMultiplexer::acquire() {
+  if(!unused.empty()) {
+    uint32_t i = unused.back();
+    unused.pop_back();
+    return i;
+  }
+
+  pool.emplace_back();
+  return (uint32_t)(pool.size() - 1);
+}
+
+// Buffers grown by a large token are trimmed before they are pooled again.
+void CSVMultiplexer::release(detail::csv::CSV_Stream& s) {
+  if(s.buf == detail::csv::CSV_NoBuffer)
+    return;
+
+  std::vector<char, StdAllocator<char>>& b = pool[s.buf];
+  b.clear();
+  if(b.capacity() > 1024 * 64)
+    b.shrink_to_fit();
+
+  unused.push_back(s.buf);
+  s.buf = detail::csv::CSV_NoBuffer;
+}
+
+char CSVMultiplexer::getSep() const {
+  return seperator;
+}
+
+void CSVMultiplexer::setSep(char s) {
+  seperator = s;
+}
+
+size_t CSVMultiplexer::getStreamCount() const {
+  return streams.size() - closed.size();
+}
+
+size_t CSVMultiplexer::getPooledBuffers() const {
+  return pool.size();
+}
+
+}
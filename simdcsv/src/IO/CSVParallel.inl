@@ -0,0 +1,490 @@
+#include "../ThreadPool.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace Wikinger {
+namespace detail {
+namespace csv {
+
+// A token found by a worker thread which is handed to the callback later on.
+struct CSV_Record {
+  uint32_t row;
+  uint32_t column;
+  std::string_view tk;
+};
+
+// Callback used by the workers when the tokens have to be delivered in row order,
+// the tokens are stored and replayed from the calling thread once the chunk is done.
+class CSV_Recorder {
+public:
+  CSV_Recorder(std::vector<CSV_Record, StdAllocator<CSV_Record>>& r) : recs(r) {}
+
+  void operator()(Error& err, uint32_t row, uint32_t col, CSVReader::Token& tk) {
+    recs.push_back({ row, col, tk.get<std::string_view>(err) });
+  }
+
+private:
+  std::vector<CSV_Record, StdAllocator<CSV_Record>>& recs;
+};
+
+// Callback used by the workers when the tokens are delivered as they are found,
+// it forwards the token along with the id of the chunk it was found in.
+template<typename F>
+class CSV_ChunkForward {
+public:
+  CSV_ChunkForward(F& f, uint32_t id) : clb(f), chunk(id) {}
+
+  void operator()(Error& err, uint32_t row, uint32_t col, CSVReader::Token& tk) {
+    clb(err, chunk, row, col, tk);
+  }
+
+private:
+  F& clb;
+  uint32_t chunk;
+};
+
+// Forwards to the callback with the rows offset by base.
+template<typename F>
+class CSV_RowOffset {
+public:
+  CSV_RowOffset(F& f, uint32_t r) : base(r), clb(f) {}
+
+  void operator()(Error& err, uint32_t row, uint32_t col, CSVReader::Token& tk) {
+    clb(err, base + row, col, tk);
+  }
+
+  uint32_t base;
+
+private:
+  F& clb;
+};
+
+// A chunk of the file and what is known about it.
+// A chunk owns every row which begins inside of it, including the last one
+// which usually ends inside one of the following chunks.
+struct CSV_Chunk {
+  CSV_Chunk();
+  ~CSV_Chunk();
+
+  // Makes sure that at least sz bytes are allocated, any data is kept
+  // and data and start are moved along with it.
+  void reserve(size_t sz, size_t alignment);
+
+  // The buffer the chunk is loaded into
+  char* mem;
+  size_t cap;
+  size_t align;
+
+  // The data of the chunk, for the first chunk this begins where the
+  // parsing begins and for the others it begins at an aligned file offset.
+  char* data;
+  size_t len;
+
+  // The file offset directly after the loaded data and whether the
+  // the file continues past it.
+  int64_t offset;
+  bool full;
+
+  // The escape carry into the chunk, this is decided by the amount
+  // of backslashes directly preceding it.
+  uint64_t esc_in;
+
+  // Whether the quote state at the end of the chunk is inverted from the one at its beginning.
+  uint64_t parity;
+
+  // The amount of newlines outside of quotes, the position of the first
+  // of them (or -1) and whether the last byte is one of them.
+  // Index 0 is used when the chunk begins outside of quotes and 1 when inside.
+  uint64_t nl_count[2];
+  int64_t first_nl[2];
+  bool end_nl[2];
+
+  // Resolved once every preceding chunk has been scanned.
+  // quote is the quote state at data, start is where the first row begins
+  // (or nullptr) and term is where the last row which begins in this chunk ends.
+  uint64_t quote;
+  char* start;
+  char* term;
+
+  // The row and column of the first token, after parsing these
+  // hold the values after the last token.
+  uint32_t row;
+  uint32_t column;
+
+  std::vector<CSV_Record, StdAllocator<CSV_Record>> recs;
+  std::atomic<bool> done;
+  Error err;
+};
+
+CSV_Chunk::CSV_Chunk() :
+  mem(nullptr), cap(0), align(0), data(nullptr), len(0), offset(0), full(false),
+  esc_in(0), parity(0), nl_count{ 0, 0 }, first_nl{ -1, -1 }, end_nl{ false, false },
+  quote(0), start(nullptr), term(nullptr), row(0), column(0), done(false) {}
+
+CSV_Chunk::~CSV_Chunk() {
+  if(mem != nullptr)
+    getAllocator().deallocate(mem, cap, align);
+}
+
+void CSV_Chunk::reserve(size_t sz, size_t alignment) {
+  if(sz <= cap)
+    return;
+
+  size_t ncap = cap * 2 > sz ? cap * 2 : sz;
+  ncap = (1 + (ncap - 1) / alignment) * alignment;
+
+  char* nmem = (char*)getAllocator().allocate(ncap, alignment);
+  if(mem != nullptr) {
+    memcpy(nmem, mem, cap);
+    getAllocator().deallocate(mem, cap, align);
+  }
+
+  data = nmem + (data - mem);
+  if(start != nullptr)
+    start = nmem + (start - mem);
+  mem = nmem;
+  cap = ncap;
+  align = alignment;
+}
+
+// Runs fn(i) for every i in [0, n) on the pool while the calling thread runs
+// drain, returns once every call has finished.
+template<typename Fn, typename Drain>
+void parallelFor(ThreadPool& pool, size_t n, Fn&& fn, Drain&& drain) {
+  ThreadPool::Group group(pool);
+  for(size_t i = 0; i < n; i++) {
+    group.run([&fn, i]() { fn(i); });
+  }
+
+  drain();
+  group.wait();
+}
+
+// Loads the file range [pos, pos + size) into the chunk where pos is aligned.
+// first is the offset of the first row to be parsed, any data before it is skipped.
+// Up to lookback aligned bytes before pos are read to decide the escape carry.
+void loadChunk(Error& err, UnbufferedFileReader& file, CSV_Chunk& ck, int64_t pos, int64_t first, size_t size, size_t alignment, size_t lookback) {
+  lookback = (int64_t)lookback < pos ? lookback : (size_t)pos;
+  size_t skip = lookback + (first > pos ? (size_t)(first - pos) : 0);
+
+  ck.data = ck.mem;
+  ck.start = nullptr;
+  ck.reserve(lookback + size + 64, alignment);
+
+  file.seek(err, pos - lookback, Whence::Begin);
+  size_t read = file.readbin(err, ck.mem, lookback + size);
+
+  ck.data   = ck.mem + skip;
+  ck.len    = read > skip ? read - skip : 0;
+  ck.offset = pos + size;
+  ck.full   = read == lookback + size;
+
+  size_t run = 0;
+  while(ck.data - run > ck.mem && ck.data[-(ptrdiff_t)run - 1] == '\\') {
+    run++;
+  }
+  ck.esc_in = run & 1;
+}
+
+// Scans the chunk using both quote states it might begin in.
+// This is the same mask stage the parsers use but since nothing is tokenized
+// it runs at a fraction of the cost. Since the newlines inside quotes when
+// beginning outside of them are the newlines outside quotes when beginning
+// inside, a single pass is enough for both.
+template<masksSig masks, tzcntSig tzcnt, andnSig andn, popcntSig popcnt>
+void scanChunk(CSV_Chunk& ck, char seperator) {
+  uint32_t row = 0;
+  uint32_t column = 0;
+  CSV_Context ctx(row, column);
+  ctx.esc_carry = ck.esc_in;
+
+  for(int h = 0; h < 2; h++) {
+    ck.nl_count[h] = 0;
+    ck.first_nl[h] = -1;
+    ck.end_nl[h] = false;
+  }
+
+  for(size_t i = 0; i < ck.len; i += 64) {
+    masks(ctx, ck.data + i, seperator);
+    uint64_t fill = quoteFill<andn>(ctx, ck.len - i);
+    uint64_t nl[2] = { andn(fill, ctx.nl_mask), ctx.nl_mask & fill };
+
+    for(int h = 0; h < 2; h++) {
+      if(nl[h] != 0) {
+        if(ck.first_nl[h] < 0)
+          ck.first_nl[h] = i + tzcnt(nl[h]);
+        ck.nl_count[h] += popcnt(nl[h]);
+      }
+      if(i + 64 >= ck.len)
+        ck.end_nl[h] = (nl[h] >> (ck.len - 1 - i)) & 1;
+    }
+  }
+
+  ck.parity = ctx.quote_carry;
+}
+
+// Finds the first newline outside of quotes at or after data + from where quote
+// is the quote state at that point, the returned pointer is one past it or
+// the end of the data if there is none.
+// The data is extended by reading from the chunk's offset while it is full,
+// it is appended to the chunk so that the row can be parsed in one go.
+template<masksSig masks, tzcntSig tzcnt, andnSig andn>
+char* findRowEnd(Error& err, UnbufferedFileReader& file, CSV_Chunk& ck, size_t from, uint64_t quote, char seperator, size_t alignment) {
+  uint32_t row = 0;
+  uint32_t column = 0;
+  CSV_Context ctx(row, column);
+  ctx.quote_carry = quote;
+
+  size_t run = 0;
+  while(ck.data + from - run > ck.mem && ck.data[from - run - 1] == '\\') {
+    run++;
+  }
+  ctx.esc_carry = run & 1;
+
+  size_t step = 1024 * 64;
+  step = (1 + (step - 1) / alignment) * alignment;
+
+  size_t scanned = from;
+  bool more = ck.full;
+
+  if(more)
+    file.seek(err, ck.offset, Whence::Begin);
+
+  while(err.peekOk()) {
+    // a partial block is only scanned once there is nothing left to read.
+    for(; scanned < ck.len && (scanned + 64 <= ck.len || !more); scanned += 64) {
+      masks(ctx, ck.data + scanned, seperator);
+      uint64_t fill = quoteFill<andn>(ctx, ck.len - scanned);
+      uint64_t nl = andn(fill, ctx.nl_mask);
+
+      if(nl != 0) {
+        return ck.data + scanned + tzcnt(nl) + 1;
+      }
+    }
+
+    if(!more)
+      break;
+
+    ck.reserve((ck.data - ck.mem) + ck.len + step + 64, alignment);
+    size_t read = file.readbin(err, ck.data + ck.len, step);
+    ck.len += read;
+    ck.offset += read;
+    ck.full = more = read == step;
+  }
+
+  return ck.data + ck.len;
+}
+
+// Finds where the last row which begins in the chunk ends.
+// Unless the chunk ends with a newline this reads past its end.
+template<masksSig masks, tzcntSig tzcnt, andnSig andn>
+void extendChunk(Error& err, UnbufferedFileReader& file, CSV_Chunk& ck, char seperator, size_t alignment) {
+  if(ck.end_nl[ck.quote] || !ck.full) {
+    ck.term = ck.data + ck.len;
+    return;
+  }
+
+  ck.term = findRowEnd<masks, tzcnt, andn>(err, file, ck, ck.len, ck.quote ^ ck.parity, seperator, alignment);
+}
+
+// Parses the rows owned by the chunk, clb is invoked on the calling thread.
+template<typename G>
+Error& parseChunk(Error& err, G& clb, CSV_Chunk& ck, char seperator) {
+  CSVMemReader mread(ck.start, ck.term);
+  static RuntimeDispatch<Error&(Error&, G&, uint32_t&, uint32_t&, char, CSVMemReader&)> dispatch{
+    { readCSV_AVX2<false, tzcnt_bmi, andn_bmi, G>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 },
+    { readCSV_SSE2<false, tzcnt_bmi, andn_bmi, G>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 },
+    { readCSV_bmi1<false, tzcnt_bmi, andn_bmi, G>, CPU::ISA::bmi1 },
+    { readCSV_AVX2<false, tzcnt_x64, andn_x64, G>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { readCSV_SSE2<false, tzcnt_x64, andn_x64, G>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { readCSV_bmi1<false, tzcnt_x64, andn_x64, G>, 0 }
+  };
+  return dispatch(err, clb, ck.row, ck.column, seperator, mread);
+}
+
+} // namespace csv
+} // namespace detail
+
+// Splits the file into chunks which are parsed on several threads.
+// The quote state is the only thing carried between chunks so every window
+// of chunks goes through three steps:
+//   1. every chunk is loaded and scanned in parallel, the scan gathers the
+//      newline counts and quote parity for both quote states it may begin in.
+//   2. the quote state and first row of every chunk is resolved in order,
+//      this is a prefix sum over the chunks and takes no time at all.
+//   3. every chunk is parsed in parallel, when ordered the tokens are recorded
+//      and replayed on the calling thread as soon as the preceding chunks are done.
+template<bool ordered, typename F>
+Error& CSVReader::readChunks(Error& err, F& clb, uint32_t threads) {
+  namespace dcsv = detail::csv;
+
+  if(!err.peekOk())
+    return err;
+
+  if(!reader.isOpen()) {
+    WK_RAISE_ERR(err, NotOpen, "CSVReader: no file open to read");
+    return err;
+  }
+
+  static RuntimeDispatch<void(dcsv::CSV_Chunk&, char)> dispatchScan{
+    { dcsv::scanChunk<dcsv::masks_AVX2, dcsv::tzcnt_bmi, dcsv::andn_bmi, dcsv::popcnt_abm>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 | CPU::ISA::popcnt },
+    { dcsv::scanChunk<dcsv::masks_SSE2, dcsv::tzcnt_bmi, dcsv::andn_bmi, dcsv::popcnt_abm>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 | CPU::ISA::popcnt },
+    { dcsv::scanChunk<dcsv::masks_x64, dcsv::tzcnt_bmi, dcsv::andn_bmi, dcsv::popcnt_abm>, CPU::ISA::bmi1 | CPU::ISA::popcnt },
+    { dcsv::scanChunk<dcsv::masks_AVX2, dcsv::tzcnt_x64, dcsv::andn_x64, dcsv::popcnt_x64>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { dcsv::scanChunk<dcsv::masks_SSE2, dcsv::tzcnt_x64, dcsv::andn_x64, dcsv::popcnt_x64>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { dcsv::scanChunk<dcsv::masks_x64, dcsv::tzcnt_x64, dcsv::andn_x64, dcsv::popcnt_x64>, 0 }
+  };
+  static RuntimeDispatch<void(Error&, UnbufferedFileReader&, dcsv::CSV_Chunk&, char, size_t)> dispatchExtend{
+    { dcsv::extendChunk<dcsv::masks_AVX2, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 },
+    { dcsv::extendChunk<dcsv::masks_SSE2, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 },
+    { dcsv::extendChunk<dcsv::masks_x64, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::bmi1 },
+    { dcsv::extendChunk<dcsv::masks_AVX2, dcsv::tzcnt_x64, dcsv::andn_x64>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { dcsv::extendChunk<dcsv::masks_SSE2, dcsv::tzcnt_x64, dcsv::andn_x64>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { dcsv::extendChunk<dcsv::masks_x64, dcsv::tzcnt_x64, dcsv::andn_x64>, 0 }
+  };
+
+  ThreadPool& pool = ThreadPool::getDefault();
+  if(threads == 0)
+    threads = pool.getThreadCount();
+
+  size_t alignment = req_alignment;
+  size_t csize = chunk_size - chunk_size % alignment;
+  if(csize == 0)
+    csize = alignment;
+
+  int64_t first = reader.tell();
+  int64_t fsize = reader.size(err);
+  int64_t begin = first - first % alignment;
+  size_t count = fsize > begin ? (size_t)((fsize - begin + csize - 1) / csize) : 0;
+
+  // every chunk in flight reads using its own handle.
+  std::vector<UnbufferedFileReader> files(threads);
+  for(UnbufferedFileReader& file : files) {
+    file.open(err, path);
+  }
+
+  std::unique_ptr<dcsv::CSV_Chunk[]> chunks(new dcsv::CSV_Chunk[threads]);
+  std::atomic<bool> abort(false);
+
+  // The state at the beginning of the next chunk.
+  uint64_t quote = 0;
+  uint32_t nrow = row;
+  bool rowStart = true;
+
+  // Carries errors from the chunks over to err.
+  auto collect = [&err, &abort](dcsv::CSV_Chunk& ck) {
+    if(!ck.err.peekOk()) {
+      Error::Code code = ck.err.getCode();
+      if(err.peekOk())
+        err.raise(code, ck.err.getPath(), ck.err.getLine(), "{}", ck.err.getMsg());
+      ck.err.reset();
+      abort = true;
+    }
+  };
+
+  for(size_t w = 0; w < count && err.peekOk(); w += threads) {
+    size_t n = count - w < threads ? count - w : threads;
+
+    dcsv::parallelFor(pool, n, [&](size_t i) {
+      dcsv::CSV_Chunk& ck = chunks[i];
+      int64_t pos = begin + (int64_t)((w + i) * csize);
+      dcsv::loadChunk(ck.err, files[i], ck, pos, first, csize, alignment, alignment);
+      dispatchScan(ck, seperator);
+    }, []() {});
+
+    for(size_t i = 0; i < n; i++) {
+      dcsv::CSV_Chunk& ck = chunks[i];
+      collect(ck);
+
+      ck.quote = quote;
+      ck.column = 0;
+      ck.done = false;
+      if(rowStart) {
+        ck.start = ck.data;
+        ck.row = nrow;
+      }
+      else if(ck.first_nl[quote] >= 0) {
+        ck.start = ck.data + ck.first_nl[quote] + 1;
+        ck.row = nrow + 1;
+      }
+      else {
+        ck.start = nullptr;
+      }
+
+      if(ck.start >= ck.data + ck.len)
+        ck.start = nullptr;
+
+      nrow += (uint32_t)ck.nl_count[quote];
+      rowStart = ck.len > 0 ? ck.end_nl[quote] : rowStart;
+      quote ^= ck.parity;
+    }
+
+    if(!err.peekOk())
+      break;
+
+    dcsv::parallelFor(pool, n, [&](size_t i) {
+      dcsv::CSV_Chunk& ck = chunks[i];
+      if(ck.start != nullptr && !abort) {
+        dispatchExtend(ck.err, files[i], ck, seperator, alignment);
+
+        if constexpr(ordered) {
+          dcsv::CSV_Recorder rec(ck.recs);
+          dcsv::parseChunk(ck.err, rec, ck, seperator);
+        }
+        else {
+          dcsv::CSV_ChunkForward<F> fwd(clb, (uint32_t)(w + i));
+          dcsv::parseChunk(ck.err, fwd, ck, seperator);
+        }
+      }
+
+      ck.done = true;
+    }, [&]() {
+      for(size_t i = 0; i < n; i++) {
+        dcsv::CSV_Chunk& ck = chunks[i];
+        pool.waitUntil([&ck]() { return ck.done.load(); });
+
+        if constexpr(ordered) {
+          for(size_t r = 0; r < ck.recs.size() && err.peekOk(); r++) {
+            Token tk = ck.recs[r].tk;
+            clb(err, ck.recs[r].row, ck.recs[r].column, tk);
+          }
+          ck.recs.clear();
+        }
+
+        if(!err.peekOk())
+          abort = true;
+
+        collect(ck);
+
+        if(ck.start != nullptr) {
+          row = ck.row;
+          column = ck.column;
+        }
+      }
+    });
+  }
+
+  reader.seek(err, 0, Whence::End);
+  return err;
+}
+
+// Parses the file on the default thread pool, threads is the amount of chunks
+// in flight and 0 uses one per worker of the pool.
+// The callback is invoked from the calling thread in row order, exactly as with read.
+template<typename F>
+Error& CSVReader::readParallel(Error& err, F& clb, uint32_t threads) {
+  return readChunks<true>(err, clb, threads);
+}
+
+// Parses the file on the default thread pool, see readParallel for threads.
+// The callback is invoked directly from the worker threads as the tokens are found
+// and must as such be thread safe, see ChunkCallback for its signature.
+// Rows are in order within a chunk and chunk ids are increasing with the file offset.
+template<typename F>
+Error& CSVReader::readParallelUnordered(Error& err, F& clb, uint32_t threads) {
+  return readChunks<false>(err, clb, threads);
+}
+
+} // namespace Wikinger
@@ -0,0 +1,294 @@
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace Wikinger {
+namespace detail {
+namespace csv {
+
+// Set in an index entry when the delimiter is a newline rather than a seperator.
+constexpr uint32_t CSV_IndexNL = 0x80000000;
+
+// A row of a batch handed to a consumer, idx is the position of the
+// first delimiter of the row in the batch's index.
+struct CSV_RowRef {
+  uint32_t row;
+  uint32_t start;
+  uint32_t idx;
+};
+
+// A buffer of the file along with the delimiters found in it.
+// The data in [first, len) is what the batch covers, the bytes before the
+// buffer's aligned data are the unfinished token (or row) carried over from the
+// previous batch. Every index entry is the offset of a delimiter outside of quotes.
+struct CSV_Batch {
+  CSV_Batch();
+  ~CSV_Batch();
+
+  void reserve(size_t sz, size_t alignment);
+
+  char* mem;
+  size_t cap;
+  size_t align;
+  size_t first;
+  size_t len;
+  bool last;
+  std::vector<uint32_t, StdAllocator<uint32_t>> idx;
+
+  // Used when fanning out, the row of the first row in the batch, the amount
+  // of consumers yet to finish with it and the rows routed to each of them.
+  uint32_t row;
+  std::atomic<uint32_t> refs;
+  std::vector<std::vector<CSV_RowRef, StdAllocator<CSV_RowRef>>> routes;
+};
+
+CSV_Batch::CSV_Batch() :
+  mem(nullptr), cap(0), align(0), first(0), len(0), last(false), row(0), refs(0) {}
+
+CSV_Batch::~CSV_Batch() {
+  if(mem != nullptr)
+    getAllocator().deallocate(mem, cap, align);
+}
+
+// Unlike CSV_Chunk::reserve the contents are not kept.
+void CSV_Batch::reserve(size_t sz, size_t alignment) {
+  if(sz <= cap)
+    return;
+
+  if(mem != nullptr)
+    getAllocator().deallocate(mem, cap, align);
+
+  cap = (1 + (sz - 1) / alignment) * alignment;
+  align = alignment;
+  mem = (char*)getAllocator().allocate(cap, alignment);
+}
+
+// Appends the delimiters outside of quotes in [from, to) to idx, this is the
+// mask stage of the parsers without any of the tokenizing.
+// Only whole blocks are indexed unless last is set, the offset where the
+// indexing stopped is returned and the rest has to be indexed along with
+// whatever data follows it.
+template<masksSig masks, tzcntSig tzcnt, andnSig andn>
+size_t indexBlocks(CSV_Context& ctx, const char* mem, size_t from, size_t to, bool last, char seperator, std::vector<uint32_t, StdAllocator<uint32_t>>& idx) {
+  size_t i = from;
+  for(; i < to && (i + 64 <= to || last); i += 64) {
+    masks(ctx, mem + i, seperator);
+    uint64_t fill = quoteFill<andn>(ctx, to - i);
+    uint64_t delim = andn(fill, ctx.sep_mask | ctx.nl_mask);
+
+    while(delim != 0) {
+      uint64_t bit = tzcnt(delim);
+      uint32_t off = (uint32_t)(i + bit);
+      idx.push_back((ctx.nl_mask >> bit & 1) ? off | CSV_IndexNL : off);
+      delim &= delim - 1;
+    }
+  }
+  return i < to ? i : to;
+}
+
+typedef size_t(indexSig)(CSV_Context&, const char*, size_t, size_t, bool, char, std::vector<uint32_t, StdAllocator<uint32_t>>&);
+
+// Returns the best indexBlocks available on this cpu.
+indexSig* selectIndex() {
+  static RuntimeDispatch<indexSig> dispatch{
+    { indexBlocks<masks_AVX2, tzcnt_bmi, andn_bmi>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 },
+    { indexBlocks<masks_SSE2, tzcnt_bmi, andn_bmi>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 },
+    { indexBlocks<masks_x64, tzcnt_bmi, andn_bmi>, CPU::ISA::bmi1 },
+    { indexBlocks<masks_AVX2, tzcnt_x64, andn_x64>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { indexBlocks<masks_SSE2, tzcnt_x64, andn_x64>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { indexBlocks<masks_x64, tzcnt_x64, andn_x64>, 0 }
+  };
+  return dispatch.get();
+}
+
+// Splits parsing into two stages running on separate threads.
+// Stage 1 reads the file and indexes the delimiters of each batch on a
+// dedicated thread, stage 2 walks those indices and invokes the callback on
+// the calling thread. The batches form a bounded single producer single
+// consumer ring, a batch stays pinned until stage 2 has released it so the
+// tokens can point straight into it. Either stage sleeps on the count of the
+// other when it gets ahead, see CSV_Counter.
+// With rows set every batch holds whole rows only, the last one excluded.
+class CSVPipeline {
+public:
+  CSVPipeline(UnbufferedFileReader& base, size_t alignment, uint32_t depth, char seperator, indexSig* index, bool rows = false);
+  ~CSVPipeline();
+
+  template<typename F>
+  Error& run(Error& err, F& clb, uint32_t& row, uint32_t& column);
+
+  template<typename F>
+  Error& fanOut(Error& err, F& clb, uint32_t consumers, CSVReader::Routing routing, uint32_t key, uint32_t& row);
+
+private:
+  void produce();
+
+  UnbufferedFileReader& reader;
+  size_t alignment;
+  size_t size;
+  char seperator;
+  indexSig* index;
+  bool rows;
+
+  std::unique_ptr<CSV_Batch[]> batches;
+  uint32_t count;
+  CSV_Counter produced;
+  CSV_Counter consumed;
+  std::atomic<bool> stop;
+  std::thread stage1;
+  Error ioerr;
+  size_t skip;
+};
+
+CSVPipeline::CSVPipeline(UnbufferedFileReader& base, size_t _alignment, uint32_t depth, char sep, indexSig* idx, bool _rows) :
+  reader(base), alignment(_alignment), size(0), seperator(sep), index(idx), rows(_rows),
+  count(depth < 2 ? 2 : depth), produced(0), consumed(0), stop(false), skip(0) {
+  size = 1024 * 1024;
+  size = (1 + (size - 1) / alignment) * alignment;
+
+  batches.reset(new CSV_Batch[count]);
+
+  // unbuffered reads have to begin on an aligned offset.
+  int64_t pos = reader.tell();
+  int64_t aligned = pos - pos % alignment;
+  skip = (size_t)(pos - aligned);
+  reader.seek(ioerr, aligned, Whence::Begin);
+
+  stage1 = std::thread(&CSVPipeline::produce, this);
+}
+
+CSVPipeline::~CSVPipeline() {
+  stop = true;
+  consumed.notify();
+  stage1.join();
+}
+
+// Stage 1, every batch begins with the token left unfinished by the previous
+// one. That batch cannot have been refilled yet since it is the newest one.
+// In rows mode the whole unfinished row and its delimiters are carried instead.
+void CSVPipeline::produce() {
+  uint32_t row = 0;
+  uint32_t column = 0;
+  CSV_Context ctx(row, column);
+
+  const char* tail = nullptr;
+  size_t carry = 0;
+  size_t pending = 0;
+  std::vector<uint32_t, StdAllocator<uint32_t>> carried;
+
+  for(uint64_t n = 0;; n++) {
+    consumed.wait([&]() { return n - consumed.load() < count || stop.load(std::memory_order_relaxed); });
+    if(n - consumed.load() >= count)
+      return;
+
+    CSV_Batch& b = batches[n % count];
+    size_t head = carry == 0 ? 0 : (1 + (carry - 1) / alignment) * alignment;
+    b.reserve(head + size + 64, alignment);
+
+    memcpy(b.mem + head - carry, tail, carry);
+    size_t read = ioerr.peekOk() ? reader.readbin(ioerr, b.mem + head, size) : 0;
+
+    b.first = head - carry + skip;
+    b.len = head + read;
+    b.last = read < size || !ioerr.peekOk();
+    b.idx.clear();
+    for(uint32_t e : carried) {
+      b.idx.push_back((uint32_t)(head - carry) + e);
+    }
+
+    size_t from = head - pending + skip;
+    skip = 0;
+    size_t scanned = index(ctx, b.mem, from, b.len, b.last, seperator, b.idx);
+
+    size_t keep = b.idx.size();
+    if(rows && !b.last) {
+      while(keep > 0 && !(b.idx[keep - 1] & CSV_IndexNL)) {
+        keep--;
+      }
+    }
+
+    size_t tk = keep == 0 ? b.first : (b.idx[keep - 1] & ~CSV_IndexNL) + 1;
+    carried.clear();
+    for(size_t i = keep; i < b.idx.size(); i++) {
+      carried.push_back(b.idx[i] - (uint32_t)tk);
+    }
+    b.idx.resize(keep);
+
+    tail = b.mem + tk;
+    carry = b.len - tk;
+    pending = b.len - scanned;
+
+    produced.store(n + 1);
+
+    if(b.last)
+      return;
+  }
+}
+
+// Stage 2, runs on the calling thread until every batch has been consumed.
+template<typename F>
+Error& CSVPipeline::run(Error& err, F& clb, uint32_t& row, uint32_t& column) {
+  for(uint64_t n = 0; err.peekOk(); n++) {
+    produced.wait([&]() { return produced.load() > n; });
+
+    CSV_Batch& b = batches[n % count];
+    size_t tk = b.first;
+
+    for(size_t i = 0; i < b.idx.size() && err.peekOk(); i++) {
+      uint32_t off = b.idx[i] & ~CSV_IndexNL;
+      CSVReader::Token token = spanToken(b.mem + tk, b.mem + off);
+      clb(err, row, column, token);
+
+      if(b.idx[i] & CSV_IndexNL) {
+        row++;
+        column = 0;
+      }
+      else {
+        column++;
+      }
+      tk = off + 1;
+    }
+
+    bool last = b.last;
+    if(last && tk < b.len && err.peekOk()) {
+      CSVReader::Token token = spanToken(b.mem + tk, b.mem + b.len);
+      clb(err, row, column, token);
+    }
+
+    consumed.store(n + 1);
+
+    if(last)
+      break;
+  }
+
+  if(!ioerr.peekOk()) {
+    if(err.peekOk())
+      err.raise(ioerr.getCode(), ioerr.getPath(), ioerr.getLine(), "{}", ioerr.getMsg());
+    ioerr.reset();
+  }
+
+  return err;
+}
+
+} // namespace csv
+} // namespace detail
+
+// Reads the file with indexing and callbacks running on two threads, see CSVPipeline.
+template<typename F>
+Error& CSVReader::readPipelined(Error& err, F& clb) {
+  namespace dcsv = detail::csv;
+
+  if(!err.peekOk())
+    return err;
+
+  if(!reader.isOpen()) {
+    WK_RAISE_ERR(err, NotOpen, "CSVReader: no file open to read");
+    return err;
+  }
+
+  dcsv::CSVPipeline pipe(reader, req_alignment, pipeline_depth, seperator, dcsv::selectIndex());
+  return pipe.run(err, clb, row, column);
+}
+
+} // namespace Wikinger
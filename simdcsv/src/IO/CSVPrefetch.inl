@@ -0,0 +1,211 @@
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace Wikinger {
+namespace detail {
+namespace csv {
+
+// Reads the file on a dedicated thread into a ring of aligned buffers which are
+// handed over to the parsing thread, this way the disk latency overlaps with the
+// tokenizing instead of stalling it on every refill.
+// The ring is a single producer single consumer queue where produced and consumed
+// count the buffers filled and released, either side sleeps on the count of the
+// other once it has waited for a little while.
+// Every buffer has some headroom before its data, the partial token at the end of
+// the previous buffer is copied in there so that it continues into the new data.
+class CSVPrefetchReader {
+public:
+  CSVPrefetchReader(UnbufferedFileReader& base, size_t alignment, uint32_t buffers);
+  ~CSVPrefetchReader();
+
+  char* pushCache(Error& err, size_t sz, uint64_t& read);
+  void settk(char* tk) { tkprev = tk; }
+  char* getCurr() const { return curr; }
+  char* getPrev() const { return tkprev; }
+  bool eof() const { return drained && curr >= end; }
+  CSV_Cache* getChunk() const { return nullptr; }
+
+  void seek(Error& err, int64_t off, Whence wh = Whence::Current) {}
+  bool isOpen() const { return reader.isOpen(); }
+  size_t getCacheAlignment() const { return alignment; }
+  size_t getCacheSize() const { return size; }
+
+  int64_t getRemBytes() const { return end - tkprev; }
+
+  bool hasDangling() const { return eof() && tkprev < end; }
+  std::string_view getDangling() const { return std::string_view(tkprev, end - tkprev); }
+
+private:
+  struct Slot {
+    char* mem;
+    size_t len;
+    bool last;
+  };
+
+  void produce();
+  void next(Error& err);
+
+  UnbufferedFileReader& reader;
+  size_t alignment;
+  size_t size;
+  size_t headroom;
+
+  std::unique_ptr<Slot[]> slots;
+  uint32_t count;
+  CSV_Counter produced;
+  CSV_Counter consumed;
+  std::atomic<bool> stop;
+  std::thread io;
+  Error ioerr;
+
+  // The slot being parsed and whether it is still held, a slot is
+  // released early when its data had to be moved to the spill buffer.
+  uint64_t active;
+  bool held;
+
+  // Tokens larger than the headroom are carried over in here.
+  char* spill;
+  size_t spillcap;
+
+  size_t skip;
+  char* curr;
+  char* end;
+  char* tkprev;
+  bool drained;
+};
+
+CSVPrefetchReader::CSVPrefetchReader(UnbufferedFileReader& base, size_t _alignment, uint32_t buffers) :
+  reader(base), alignment(_alignment), size(0), headroom(0),
+  count(buffers < 2 ? 2 : buffers), produced(0), consumed(0), stop(false),
+  active(0), held(false), spill(nullptr), spillcap(0), skip(0),
+  curr(nullptr), end(nullptr), tkprev(nullptr), drained(false) {
+  size = 1024 * 1024;
+  size = (1 + (size - 1) / alignment) * alignment;
+  headroom = 1024 * 64;
+  headroom = (1 + (headroom - 1) / alignment) * alignment;
+
+  slots.reset(new Slot[count]);
+  for(uint32_t i = 0; i < count; i++) {
+    slots[i].mem = (char*)getAllocator().allocate(headroom + size + 64, alignment);
+    slots[i].len = 0;
+    slots[i].last = false;
+  }
+
+  // unbuffered reads have to begin on an aligned offset.
+  int64_t pos = reader.tell();
+  int64_t aligned = pos - pos % alignment;
+  skip = (size_t)(pos - aligned);
+
+  reader.seek(ioerr, aligned, Whence::Begin);
+
+  io = std::thread(&CSVPrefetchReader::produce, this);
+}
+
+CSVPrefetchReader::~CSVPrefetchReader() {
+  stop = true;
+  consumed.notify();
+  io.join();
+
+  for(uint32_t i = 0; i < count; i++) {
+    getAllocator().deallocate(slots[i].mem, headroom + size + 64, alignment);
+  }
+
+  if(spill != nullptr)
+    getAllocator().deallocate(spill, spillcap, alignment);
+}
+
+// Runs on the io thread, fills every free slot until the file is exhausted.
+void CSVPrefetchReader::produce() {
+  for(uint64_t n = 0;; n++) {
+    consumed.wait([&]() { return n - consumed.load() < count || stop.load(std::memory_order_relaxed); });
+    if(n - consumed.load() >= count)
+      return;
+
+    Slot& s = slots[n % count];
+    s.len = ioerr.peekOk() ? reader.readbin(ioerr, s.mem + headroom, size) : 0;
+    s.last = s.len < size || !ioerr.peekOk();
+    produced.store(n + 1);
+
+    if(s.last)
+      return;
+  }
+}
+
+// Moves on to the next filled slot and carries the partial token over.
+void CSVPrefetchReader::next(Error& err) {
+  uint64_t n = curr != nullptr ? active + 1 : 0;
+
+  produced.wait([&]() { return produced.load() > n; });
+
+  Slot& s = slots[n % count];
+  char* data = s.mem + headroom;
+  size_t cpy = curr != nullptr ? (size_t)(end - tkprev) : 0;
+  char* base;
+
+  if(cpy <= headroom) {
+    base = data - cpy;
+    memcpy(base, tkprev, cpy);
+  }
+  else {
+    size_t need = cpy + s.len + 64;
+    if(need > spillcap) {
+      size_t ncap = spillcap * 2 > need ? spillcap * 2 : need;
+      ncap = (1 + (ncap - 1) / alignment) * alignment;
+      char* nspill = (char*)getAllocator().allocate(ncap, alignment);
+      memcpy(nspill, tkprev, cpy);
+      if(spill != nullptr)
+        getAllocator().deallocate(spill, spillcap, alignment);
+      spill = nspill;
+      spillcap = ncap;
+    }
+    else {
+      memmove(spill, tkprev, cpy);
+    }
+    memcpy(spill + cpy, data, s.len);
+    base = spill;
+  }
+
+  // the token is out of the previous slot, it can be refilled.
+  if(held)
+    consumed.store(active + 1);
+
+  active = n;
+  held = base != spill;
+  if(!held)
+    consumed.store(active + 1);
+
+  tkprev = base;
+  curr   = base + cpy;
+  end    = base + cpy + s.len;
+  drained = s.last;
+
+  if(skip > 0) {
+    curr += skip;
+    tkprev = curr;
+    skip = 0;
+  }
+
+  if(drained && !ioerr.peekOk()) {
+    if(err.peekOk())
+      err.raise(ioerr.getCode(), ioerr.getPath(), ioerr.getLine(), "{}", ioerr.getMsg());
+    ioerr.reset();
+  }
+}
+
+char* CSVPrefetchReader::pushCache(Error& err, size_t sz, uint64_t& read) {
+  if((curr == nullptr || curr >= end) && !drained) {
+    next(err);
+  }
+
+  ptrdiff_t avail = end - curr;
+  read = avail <= 0 ? 0 : (avail < (ptrdiff_t)sz ? avail : sz);
+
+  char* res = curr;
+  curr += sz;
+  return res;
+}
+
+} // namespace csv
+} // namespace detail
+} // namespace Wikinger
@@ -0,0 +1,67 @@
+#ifndef WK_CSVPUSHPARSER_H
+#define WK_CSVPUSHPARSER_H
+
+#include "CSVReader.h"
+
+#include <chrono>
+#include <vector>
+
+namespace Wikinger {
+
+class CSVPushParser {
+public:
+  CSVPushParser(char seperator = ',');
+
+  template<typename F>
+  Error& feed(Error& err, F& clb, const char* data, size_t len);
+  template<typename F>
+  Error& flush(Error& err, F& clb);
+  template<typename F>
+  Error& finish(Error& err, F& clb);
+
+  void reset();
+
+  char getSep() const;
+  void setSep(char s);
+
+  uint32_t getRow() const;
+
+  void setLatency(size_t min_batch, uint32_t max_latency_us);
+
+private:
+  template<typename F>
+  void emit(Error& err, F& clb, const char* mem, size_t base, size_t& tk, bool join);
+  template<typename F>
+  void hold(Error& err, F& clb, size_t arrived);
+  template<typename F>
+  void scanPartial(Error& err, F& clb);
+  void skipEmitted();
+
+  char seperator;
+  uint32_t row;
+  uint32_t column;
+  detail::csv::CSV_Context ctx;
+  detail::csv::indexSig* index;
+
+  // The unfinished token followed by the bytes which did not fill a whole
+  // block yet, the last pending bytes of carry are still to be indexed.
+  // When partial blocks are scanned the tokens before tk have been emitted
+  // already and the first scanned pending bytes are known to be done with.
+  std::vector<char, StdAllocator<char>> carry;
+  size_t pending;
+  size_t tk;
+  size_t scanned;
+
+  size_t min_batch;
+  uint32_t max_latency;
+  std::chrono::steady_clock::time_point held_since;
+
+  std::vector<uint32_t, StdAllocator<uint32_t>> idx;
+};
+
+}
+
+#include "CSVPushParser.inl"
+#include "CSVFollow.inl"
+
+#endif// WK_CSVPUSHPARSER_H
@@ -0,0 +1,216 @@
+namespace Wikinger {
+
+// Parses csv pushed to it in pieces of any size and alignment, such as data
+// arriving from a socket. Tokens are emitted as soon as their delimiter has been
+// fed, the blocks are indexed straight from the caller's memory and only the
+// unfinished token and the bytes short of a whole block are copied to the carry.
+CSVPushParser::CSVPushParser(char sep) :
+  seperator(sep), row(0), column(0), ctx(row, column),
+  index(detail::csv::selectIndex()), pending(0), tk(0), scanned(0),
+  min_batch(SIZE_MAX), max_latency(0) {}
+
+void CSVPushParser::reset() {
+  row = 0;
+  column = 0;
+  ctx.quote_carry = 0;
+  ctx.esc_carry = 0;
+  carry.clear();
+  pending = 0;
+  tk = 0;
+  scanned = 0;
+}
+
+char CSVPushParser::getSep() const {
+  return seperator;
+}
+
+void CSVPushParser::setSep(char s) {
+  seperator = s;
+}
+
+uint32_t CSVPushParser::getRow() const {
+  return row;
+}
+
+// By default the bytes short of a whole block are held back until the block
+// is completed, which holds back the rows ending in them as well.
+// With a latency set the partial block is scanned for completed rows once at
+// least min_batch bytes have arrived since it was last scanned, or once its
+// oldest bytes have waited for max_latency_us microseconds, 0 for no limit.
+// Every scan of a partial block is repeated when the block fills up, so small
+// batches trade throughput for latency. Time is only checked when data is fed,
+// call flush from a timer to bound the latency of a stream that went quiet.
+void CSVPushParser::setLatency(size_t batch, uint32_t latency_us) {
+  min_batch = batch;
+  max_latency = latency_us;
+}
+
+// Drops the delimiters from idx which have been emitted by an earlier scan.
+void CSVPushParser::skipEmitted() {
+  size_t k = 0;
+  while(k < idx.size() && (idx[k] & ~detail::csv::CSV_IndexNL) < tk) {
+    k++;
+  }
+  idx.erase(idx.begin(), idx.begin() + k);
+}
+
+// Invokes clb for every delimiter in idx, the offsets are relative to mem + base.
+// tk is where the current token begins in mem, when join is set the token began
+// in an earlier piece and the carry is completed with the rest of it instead.
+template<typename F>
+void CSVPushParser::emit(Error& err, F& clb, const char* mem, size_t base, size_t& tk, bool join) {
+  for(size_t i = 0; i < idx.size() && err.peekOk(); i++) {
+    size_t off = base + (idx[i] & ~detail::csv::CSV_IndexNL);
+
+    if(join) {
+      carry.insert(carry.end(), mem + tk, mem + off);
+      CSVReader::Token token = detail::csv::spanToken(carry.data(), carry.data() + carry.size());
+      clb(err, row, column, token);
+      carry.clear();
+      join = false;
+    }
+    else {
+      CSVReader::Token token = detail::csv::spanToken(mem + tk, mem + off);
+      clb(err, row, column, token);
+    }
+
+    if(idx[i] & detail::csv::CSV_IndexNL) {
+      row++;
+      column = 0;
+    }
+    else {
+      column++;
+    }
+    tk = off + 1;
+  }
+}
+
+template<typename F>
+Error& CSVPushParser::feed(Error& err, F& clb, const char* data, size_t len) {
+  if(!err.peekOk())
+    return err;
+
+  size_t i = 0;
+
+  // complete the block left pending by the previous piece first.
+  if(pending > 0) {
+    size_t take = 64 - pending < len ? 64 - pending : len;
+    carry.insert(carry.end(), data, data + take);
+    pending += take;
+    i = take;
+
+    if(pending < 64) {
+      hold(err, clb, take);
+      return err;
+    }
+
+    size_t from = carry.size() - 64;
+    carry.resize(carry.size() + 64);
+    idx.clear();
+    index(ctx, carry.data(), from, from + 64, false, seperator, idx);
+    carry.resize(from + 64);
+    skipEmitted();
+    emit(err, clb, carry.data(), 0, tk, false);
+
+    carry.erase(carry.begin(), carry.begin() + tk);
+    pending = 0;
+    tk = 0;
+    scanned = 0;
+  }
+
+  // then every whole block directly from data, sliced to keep the index small.
+  size_t full = i + (len - i) / 64 * 64;
+  size_t slice = 1024 * 1024;
+  bool join = !carry.empty();
+  size_t at = i;
+
+  for(size_t s = i; s < full && err.peekOk(); s += slice) {
+    size_t e = full - s < slice ? full : s + slice;
+    idx.clear();
+    index(ctx, data + s, 0, e - s, false, seperator, idx);
+    emit(err, clb, data, s, at, join && !idx.empty());
+    join = join && idx.empty();
+  }
+
+  if(join)
+    carry.insert(carry.end(), data + i, data + len);
+  else
+    carry.assign(data + at, data + len);
+  pending = len - full;
+
+  hold(err, clb, pending);
+  return err;
+}
+
+// Scans the partial block if the latency settings ask for it, arrived is
+// the amount of bytes just added to it.
+template<typename F>
+void CSVPushParser::hold(Error& err, F& clb, size_t arrived) {
+  if(pending == scanned || !err.peekOk())
+    return;
+
+  bool due = pending - scanned >= min_batch;
+  if(max_latency > 0) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(pending - scanned == arrived)
+      held_since = now;
+    due = due || now - held_since >= std::chrono::microseconds(max_latency);
+  }
+
+  if(due)
+    scanPartial(err, clb);
+}
+
+// Emits the tokens completed within the partial block. The carries are left
+// as they were since the block is indexed again once it is whole.
+template<typename F>
+void CSVPushParser::scanPartial(Error& err, F& clb) {
+  uint64_t quote = ctx.quote_carry;
+  uint64_t esc = ctx.esc_carry;
+  size_t len = carry.size();
+
+  carry.resize(len + 64);
+  idx.clear();
+  index(ctx, carry.data(), len - pending, len, true, seperator, idx);
+  carry.resize(len);
+
+  ctx.quote_carry = quote;
+  ctx.esc_carry = esc;
+
+  skipEmitted();
+  emit(err, clb, carry.data(), 0, tk, false);
+  scanned = pending;
+}
+
+// Emits the rows held back in the partial block regardless of the latency settings.
+template<typename F>
+Error& CSVPushParser::flush(Error& err, F& clb) {
+  if(pending > scanned && err.peekOk())
+    scanPartial(err, clb);
+  return err;
+}
+
+// Flushes the last token, the parser is reset afterwards so that it can take
+// on another stream.
+template<typename F>
+Error& CSVPushParser::finish(Error& err, F& clb) {
+  size_t len = carry.size();
+
+  if(pending > 0 && err.peekOk()) {
+    carry.resize(len + 64);
+    idx.clear();
+    index(ctx, carry.data(), len - pending, len, true, seperator, idx);
+    skipEmitted();
+    emit(err, clb, carry.data(), 0, tk, false);
+  }
+
+  if(tk < len && err.peekOk()) {
+    CSVReader::Token token = detail::csv::spanToken(carry.data() + tk, carry.data() + len);
+    clb(err, row, column, token);
+  }
+
+  reset();
+  return err;
+}
+
+}
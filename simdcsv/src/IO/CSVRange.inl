@@ -0,0 +1,127 @@
+namespace Wikinger {
+namespace detail {
+namespace csv {
+
+// Guesses whether at is inside quotes by looking at the closest quote before
+// it which can only be read one way. A quote followed by any other character
+// than a quote or a delimiter either opens a field or ends a doubled quote,
+// inside quotes after it either way. A quote preceded by such a character
+// either closes a field or begins a doubled quote, outside after it in terms
+// of the parity. A seperator or a newline next to a quote says nothing since
+// quoted fields hold them as well. Quotes matching neither pattern only count
+// towards the parity.
+// If no such quote exists in [begin, at) then begin is assumed to be outside
+// of quotes.
+uint64_t guessQuote(const char* begin, const char* at, const char* end, char seperator) {
+  auto isOther = [seperator](char c) {
+    return c != '"' && c != seperator && c != '\n' && c != '\r';
+  };
+
+  uint64_t parity = 0;
+  for(const char* p = at - 1; p >= begin; p--) {
+    if(*p != '"')
+      continue;
+
+    size_t run = 0;
+    while(p - run > begin && p[-(ptrdiff_t)run - 1] == '\\') {
+      run++;
+    }
+    if(run & 1)
+      continue;
+
+    bool inside = p + 1 < end && isOther(p[1]);
+    bool outside = p > begin ? isOther(p[-1]) : false;
+
+    if(inside && !outside)
+      return parity ^ 1;
+    if(outside && !inside)
+      return parity;
+
+    parity ^= 1;
+  }
+
+  return parity;
+}
+
+// Finds the first row which begins at or after the file offset at.
+// The result only depends on the bytes around at and not on where the
+// parsing began, which is what keeps adjacent ranges from disagreeing.
+template<masksSig masks, tzcntSig tzcnt, andnSig andn>
+int64_t resyncRow(Error& err, UnbufferedFileReader& file, CSV_Chunk& ck, int64_t at, CSVReader::QuoteState state, char seperator, size_t alignment) {
+  if(at <= 0)
+    return 0;
+
+  size_t window = 1024 * 64;
+  window = (1 + (window - 1) / alignment) * alignment;
+
+  int64_t pos = at - at % alignment;
+  loadChunk(err, file, ck, pos, at, window, alignment, window);
+
+  uint64_t quote;
+  if(state == CSVReader::QuoteState::Unknown)
+    quote = guessQuote(ck.mem, ck.data, ck.data + ck.len, seperator);
+  else
+    quote = state == CSVReader::QuoteState::Inside;
+
+  if(quote == 0 && ck.data[-1] == '\n')
+    return at;
+
+  char* term = findRowEnd<masks, tzcnt, andn>(err, file, ck, 0, quote, seperator, alignment);
+  return at + (term - ck.data);
+}
+
+} // namespace csv
+} // namespace detail
+
+// Parses the rows which begin in the byte range [range.begin, range.end).
+// Neither end has to lie on a row boundary, the first row beginning at or
+// after each end is found and the rows in between are parsed. Both ends are
+// resolved the same way so a file split into adjacent ranges is parsed
+// exactly once. Rows are counted from zero at the first row of the range.
+template<typename F>
+Error& CSVReader::read(Error& err, F& clb, const Range& range) {
+  namespace dcsv = detail::csv;
+
+  if(!err.peekOk())
+    return err;
+
+  if(!reader.isOpen()) {
+    WK_RAISE_ERR(err, NotOpen, "CSVReader: no file open to read");
+    return err;
+  }
+
+  static RuntimeDispatch<int64_t(Error&, UnbufferedFileReader&, dcsv::CSV_Chunk&, int64_t, QuoteState, char, size_t)> dispatchResync{
+    { dcsv::resyncRow<dcsv::masks_AVX2, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 },
+    { dcsv::resyncRow<dcsv::masks_SSE2, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 },
+    { dcsv::resyncRow<dcsv::masks_x64, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::bmi1 },
+    { dcsv::resyncRow<dcsv::masks_AVX2, dcsv::tzcnt_x64, dcsv::andn_x64>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { dcsv::resyncRow<dcsv::masks_SSE2, dcsv::tzcnt_x64, dcsv::andn_x64>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { dcsv::resyncRow<dcsv::masks_x64, dcsv::tzcnt_x64, dcsv::andn_x64>, 0 }
+  };
+  static RuntimeDispatch<Error&(Error&, F&, uint32_t&, uint32_t&, char, dcsv::CSVFileReader&)> dispatch{
+    { dcsv::readCSV_AVX2<false, dcsv::tzcnt_bmi, dcsv::andn_bmi, F>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 },
+    { dcsv::readCSV_SSE2<false, dcsv::tzcnt_bmi, dcsv::andn_bmi, F>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 },
+    { dcsv::readCSV_bmi1<false, dcsv::tzcnt_bmi, dcsv::andn_bmi, F>, CPU::ISA::bmi1 },
+    { dcsv::readCSV_AVX2<false, dcsv::tzcnt_x64, dcsv::andn_x64, F>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { dcsv::readCSV_SSE2<false, dcsv::tzcnt_x64, dcsv::andn_x64, F>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { dcsv::readCSV_bmi1<false, dcsv::tzcnt_x64, dcsv::andn_x64, F>, 0 }
+  };
+
+  int64_t fsize = reader.size(err);
+  dcsv::CSV_Chunk ck;
+
+  int64_t first = range.begin < fsize ? dispatchResync(err, reader, ck, range.begin, range.begin_quote, seperator, req_alignment) : fsize;
+  int64_t last = range.end < fsize ? dispatchResync(err, reader, ck, range.end, range.end_quote, seperator, req_alignment) : fsize;
+
+  row = 0;
+  column = 0;
+
+  if(!err.peekOk() || first >= last)
+    return err;
+
+  dcsv::CSVFileReader cread(reader, req_alignment);
+  cread.setRange(err, first, last);
+  return dispatch(err, clb, row, column, seperator, cread);
+}
+
+} // namespace Wikinger
@@ -3,21 +3,63 @@
 
 #include "../Error.h"
 #include "FileReader.h"
+#include "../Allocator.h"
 
+#include <atomic>
 #include <string_view>
 
 namespace Wikinger {
 
+class CSVRows;
+class CSVRowIndex;
+class CSVKeyIndex;
+class CSVZoneMap;
+struct CSVCheckpoint;
+class CSVBlockHashes;
+class CSVRetained;
+
+namespace detail {
+namespace csv {
+struct CSV_Cache;
+}
+}
+
 class CSVReader {
 public:
   class Token;
 
   typedef void(Callback)(Error& err, uint32_t row, uint32_t col, Token& tk);
+  typedef void(ChunkCallback)(Error& err, uint32_t chunk, uint32_t row, uint32_t col, Token& tk);
+
+  enum class QuoteState : uint8_t {
+    Unknown,
+    Outside,
+    Inside
+  };
+
+  enum class Routing : uint8_t {
+    RoundRobin,
+    KeyHash
+  };
+
+  // A byte range of the file, the quote states at its ends are guessed unless known.
+  struct Range {
+    int64_t begin;
+    int64_t end;
+    QuoteState begin_quote = QuoteState::Unknown;
+    QuoteState end_quote = QuoteState::Unknown;
+  };
+
+  // The amount of rows of a file and the most columns of any of them.
+  struct Shape {
+    uint64_t rows = 0;
+    uint64_t columns = 0;
+  };
 
 public:
   class Token {
   public:
-    Token(std::string_view m) : mem(m) {}
+    Token(std::string_view m, detail::csv::CSV_Cache* ck = nullptr) : mem(m), chunk(ck) {}
 
     template<typename T>
     T get(Error& err);
@@ -27,34 +69,152 @@ public:
       return mem;
     }
 
+    // Keeps the token valid past the callback, see CSVRetained.
+    CSVRetained retain() const;
+
   private:
     std::string_view mem;
+    detail::csv::CSV_Cache* chunk;
   };
 
   template<typename F>
   Error& readHeader(Error& err, F& clb);
   template<typename F>
   Error& read(Error& err, F& clb);
+  template<typename F>
+  Error& read(Error& err, F& clb, const Range& range);
+  template<typename F>
+  Error& readParallel(Error& err, F& clb, uint32_t threads = 0);
+  template<typename F>
+  Error& readParallelUnordered(Error& err, F& clb, uint32_t threads = 0);
+  template<typename F>
+  Error& readFanOut(Error& err, F& clb, uint32_t consumers, Routing routing = Routing::RoundRobin, uint32_t key = 0);
+
+  template<typename F>
+  Error& follow(Error& err, F& clb, const std::atomic<bool>& stop, uint32_t poll_ms = 250);
+
+  CSVRows rows(Error& err);
+  CSVRows lazyRows(Error& err);
+
+  uint64_t count(Error& err);
+  Shape shape(Error& err);
+
+  Error& resume(Error& err, const CSVCheckpoint& cp);
+
+  template<typename F>
+  Error& readChanged(Error& err, F& clb, CSVBlockHashes& hashes);
+
+  Error& buildIndex(Error& err, CSVRowIndex& index, uint32_t stride = 1024);
+  Error& loadIndex(Error& err, CSVRowIndex& index, uint32_t stride = 0);
+  template<typename F>
+  Error& getRow(Error& err, F& clb, const CSVRowIndex& index, uint64_t n);
+  template<typename F>
+  Error& getRange(Error& err, F& clb, const CSVRowIndex& index, uint64_t first, uint64_t last);
+
+  Error& buildKeyIndex(Error& err, CSVKeyIndex& index);
+  Error& loadKeyIndex(Error& err, CSVKeyIndex& index);
+  template<typename F>
+  Error& lookup(Error& err, F& clb, const CSVKeyIndex& index, std::string_view key);
+
+  Error& buildZoneMap(Error& err, CSVZoneMap& zones);
+  Error& loadZoneMap(Error& err, CSVZoneMap& zones);
+  template<typename F>
+  Error& scanRange(Error& err, F& clb, const CSVZoneMap& zones, uint32_t col, double lo, double hi);
+  template<typename F>
+  Error& scanEqual(Error& err, F& clb, const CSVZoneMap& zones, uint32_t col, std::string_view key);
+
+  template<typename F>
+  Error& findSorted(Error& err, F& clb, uint32_t col, std::string_view key, bool numeric = false);
+  template<typename F>
+  Error& findSortedRange(Error& err, F& clb, uint32_t col, std::string_view first, std::string_view last, bool numeric = false);
+
+  template<typename F>
+  Error& tail(Error& err, F& clb, uint64_t n, bool reverse = false);
 
   char getSep() const;
   void setSep(char s);
 
+  size_t getChunkSize() const;
+  void setChunkSize(size_t sz);
+
+  uint32_t getReadAhead() const;
+  void setReadAhead(uint32_t buffers);
+
+  uint32_t getPipeline() const;
+  void setPipeline(uint32_t depth);
+
+  uint64_t getSkipRows() const;
+  void setSkipRows(uint64_t rows);
+
+  uint64_t getLimit() const;
+  void setLimit(uint64_t rows);
+
+  ~CSVReader();
+
   Error& open(Error& err, const Filepath& path);
   void close();
 
   bool isOpen() const;
 
 private:
+  template<bool ordered, typename F>
+  Error& readChunks(Error& err, F& clb, uint32_t threads);
+  template<typename F>
+  Error& readPipelined(Error& err, F& clb);
+  template<typename F>
+  Error& readWindow(Error& err, F& clb);
+  template<typename F, typename B, typename R>
+  Error& scanZones(Error& err, F& clb, const CSVZoneMap& zones, B& block, R& keep);
+  int64_t lowerBound(Error& err, uint32_t col, std::string_view key, bool numeric);
+  void unpark();
+
   char seperator = ',';
   uint32_t row = 0;
   uint32_t column = 0;
+  size_t chunk_size = 1024 * 1024 * 4;
+  uint32_t read_ahead = 0;
+  uint32_t pipeline_depth = 0;
+  uint64_t skip_rows = 0;
+  uint64_t row_limit = 0;
 
   UnbufferedFileReader reader;
+  Filepath path;
   size_t req_alignment;
+
+  // The cache readHeader stopped in, at is the file offset of its first
+  // unparsed byte. read continues in it while the file is still there.
+  struct Parked {
+    detail::csv::CSV_Cache* cache = nullptr;
+    int64_t at = 0;
+    size_t off = 0;
+    size_t len = 0;
+    bool last = false;
+  } parked;
 };
 
 }
 
+#include "CSVCounter.inl"
+#include "CSVCache.inl"
 #include "CSVReader.inl"
+#include "CSVParallel.inl"
+#include "CSVRange.inl"
+#include "CSVPipeline.inl"
+#include "CSVFanOut.inl"
+#include "CSVRows.inl"
+#include "CSVIndex.inl"
+#include "CSVKeyIndex.inl"
+#include "CSVZoneMap.inl"
+#include "CSVSorted.inl"
+#include "CSVTail.inl"
+#include "CSVCheckpoint.inl"
+#include "CSVChanges.inl"
+#include "CSVCount.inl"
+#include "CSVWindow.inl"
+#include "CSVUnescape.inl"
+
+// follow is defined along with the push parser it is built on, which needs
+// the reader declared first whichever of the two headers is included first.
+#include "CSVPushParser.h"
 
 #endif// WK_CSVREADER_H
@@ -1,4 +1,5 @@
 #include "../RuntimeDispatch.h"
+#include "CSVPrefetch.inl"
 
 // this dependency is not used but provided because it is nice
 // remove this include and the detail::csv::readCSV function at your own discretion
@@ -9,14 +10,21 @@
 namespace Wikinger {
 
 Error& CSVReader::open(Error& err, const Filepath& path) {
+  unpark();
   row = 0;
   column = 0;
   Error& res = reader.open(err, path);
   req_alignment = reader.getAlignment(path);
+  this->path = path;
   return res;
 }
 
+CSVReader::~CSVReader() {
+  unpark();
+}
+
 void CSVReader::close() {
+  unpark();
   reader.close();
 }
 
@@ -32,6 +40,61 @@ void CSVReader::setSep(char s) {
   seperator = s;
 }
 
+size_t CSVReader::getChunkSize() const {
+  return chunk_size;
+}
+
+void CSVReader::setChunkSize(size_t sz) {
+  chunk_size = sz;
+}
+
+uint32_t CSVReader::getReadAhead() const {
+  return read_ahead;
+}
+
+// Sets the amount of buffers read ahead by a dedicated thread during read,
+// 0 reads on the parsing thread.
+void CSVReader::setReadAhead(uint32_t buffers) {
+  read_ahead = buffers;
+}
+
+uint32_t CSVReader::getPipeline() const {
+  return pipeline_depth;
+}
+
+// Sets the amount of batches stage 1 may run ahead of stage 2 when reading
+// in two stages, 0 reads in a single stage. Takes precedence over read ahead.
+void CSVReader::setPipeline(uint32_t depth) {
+  pipeline_depth = depth;
+}
+
+uint64_t CSVReader::getSkipRows() const {
+  return skip_rows;
+}
+
+// Sets the amount of rows read skips before the first row it parses, the
+// skipped rows are found without being tokenized and are still counted.
+void CSVReader::setSkipRows(uint64_t rows) {
+  skip_rows = rows;
+}
+
+uint64_t CSVReader::getLimit() const {
+  return row_limit;
+}
+
+// Sets the most rows read parses, nothing past them is read. 0 is no limit.
+void CSVReader::setLimit(uint64_t rows) {
+  row_limit = rows;
+}
+
+// Returns the cache left by readHeader to the pool.
+void CSVReader::unpark() {
+  if(parked.cache != nullptr) {
+    detail::csv::CSV_CachePool::get().release(parked.cache);
+    parked.cache = nullptr;
+  }
+}
+
 namespace detail {
 namespace csv {
 
@@ -46,16 +109,24 @@ public:
   void settk(char* tk) { tkprev = tk; }
   char* getCurr() const { return curr; }
   char* getPrev() const { return tkprev; }
-  bool eof() const { return reader.eof(); }
+  bool eof() const { return drained && curr >= end; }
+
+  // The chunk the tokens currently point into, see CSVReader::Token::retain.
+  CSV_Cache* getChunk() const { return chunk; }
+
+  void setRange(Error& err, int64_t begin, int64_t end = -1);
+
+  CSV_Cache* detach(size_t& off, size_t& len, bool& last);
+  void attach(CSV_Cache* ck, size_t off, size_t len, bool last);
 
   void seek(Error& err, int64_t off, Whence wh = Whence::Current) { reader.seek(err, off, wh); }
   bool isOpen() const { return reader.isOpen(); }
   size_t getCacheAlignment() const { return alignment; }
   size_t getCacheSize() const { return size; }
 
-  int64_t getRemBytes() const { return size + cache - tkprev; }
+  int64_t getRemBytes() const { return end - tkprev; }
 
-  bool hasDangling() const { return eof() && tkprev >= end; }
+  bool hasDangling() const { return eof() && tkprev < end; }
   std::string_view getDangling() const { return std::string_view(tkprev, end - tkprev); }
 
 private:
@@ -63,17 +134,27 @@ private:
   void destroyCache();
 
   UnbufferedFileReader& reader;
+  CSV_Cache* chunk;
   char* cache;
   size_t alignment;
   size_t size;
   char* curr;
   char* end;
   char* tkprev;
+
+  // set once a read comes up short, after which no more data is fetched.
+  bool drained;
+
+  // bytes to skip at the beginning of the first read and the amount of
+  // bytes left to read, negative when reading until the end of the file.
+  size_t skip;
+  int64_t remaining;
 };
 
 CSVFileReader::CSVFileReader(UnbufferedFileReader& base, size_t _alignment) :
-  reader(base), cache(nullptr), alignment(0), size(0),
-  curr(nullptr), end(nullptr), tkprev(nullptr) {
+  reader(base), chunk(nullptr), cache(nullptr), alignment(0), size(0),
+  curr(nullptr), end(nullptr), tkprev(nullptr), drained(false),
+  skip(0), remaining(-1) {
   createCache(_alignment);
 }
 
@@ -83,16 +164,20 @@ CSVFileReader::~CSVFileReader() {
 
 void CSVFileReader::createCache(size_t align) {
   if(cache == nullptr) {
-    size_t i_want_to_be_size = 1024 * 1024 * 4;
+    // the cache along with its padding below stays within 4MB, which are
+    // whole huge pages rather than a third one mapped for the padding.
+    size_t i_want_to_be_size = 1024 * 1024 * 4 - 64;
 
     // size is now an integer of alignment.
-    i_want_to_be_size += align / 2;
     i_want_to_be_size = i_want_to_be_size - i_want_to_be_size % align;
 
     if(i_want_to_be_size == 0)
       i_want_to_be_size = align;
 
-    cache = (char*)_aligned_malloc(i_want_to_be_size, align);
+    // the padding is for the blocks which straddle the end of the cache
+    // when the first read did not begin on an aligned offset.
+    chunk = CSV_CachePool::get().acquire(i_want_to_be_size + 64, align);
+    cache = chunk->mem;
     size = i_want_to_be_size;
     alignment = align;
     curr = cache;
@@ -102,8 +187,9 @@ void CSVFileReader::createCache(size_t align) {
 }
 
 void CSVFileReader::destroyCache() {
-  if(cache != nullptr) {
-    _aligned_free(cache);
+  if(chunk != nullptr) {
+    CSV_CachePool::get().release(chunk);
+    chunk = nullptr;
     cache = nullptr;
     tkprev = nullptr;
     curr = nullptr;
@@ -114,20 +200,140 @@ void CSVFileReader::destroyCache() {
 }
 
 char* CSVFileReader::pushCache(Error& err, size_t sz, uint64_t& read) {
-  read = sz;
-  if(curr >= end) {
+  if(curr >= end && !drained) {
     ptrdiff_t cpy = end - tkprev;
     ptrdiff_t aligned_cpy = (1 + (cpy - 1) / alignment) * alignment;
     ptrdiff_t off = aligned_cpy - cpy;
-    memcpy(cache + off, tkprev, cpy);
+
+    // tokens of the chunk have been retained so it cannot be overwritten,
+    // the reader continues in a fresh one and leaves it to them.
+    if(chunk->refs.load(std::memory_order_acquire) > 1) {
+      CSV_Cache* fresh = CSV_CachePool::get().acquire(chunk->size, chunk->alignment);
+      memcpy(fresh->mem + off, tkprev, cpy);
+      CSV_CachePool::get().release(chunk);
+      chunk = fresh;
+      cache = fresh->mem;
+    }
+    else {
+      memmove(cache + off, tkprev, cpy);
+    }
     size_t batch = reader.readbin(err, cache + aligned_cpy, size - aligned_cpy);
 
-    read   = batch < sz ? batch : sz;
+    // A short read means the end of the file has been reached, anything
+    // past end is garbage and is masked away by the parser.
+    drained = batch < size - aligned_cpy;
+    if(remaining >= 0) {
+      if((int64_t)batch >= remaining) {
+        batch = (size_t)remaining;
+        drained = true;
+      }
+      remaining -= batch;
+    }
+
     curr   = cache + aligned_cpy;
     tkprev = cache + off;
     end    = cache + aligned_cpy + batch;
+
+    if(skip > 0) {
+      curr += skip;
+      tkprev = curr;
+      skip = 0;
+    }
   }
 
+  ptrdiff_t avail = end - curr;
+  read = avail <= 0 ? 0 : (avail < (ptrdiff_t)sz ? avail : sz);
+
+  char* res = curr;
+  curr += sz;
+  return res;
+}
+
+// Restricts the reader to the file range [begin, end), the whole remainder
+// of the file is read when end is negative.
+// Unbuffered reads have to begin on an aligned offset so the file is seeked
+// to the aligned offset before begin and the bytes in between are skipped.
+void CSVFileReader::setRange(Error& err, int64_t begin, int64_t end) {
+  int64_t pos = begin - begin % alignment;
+  reader.seek(err, pos, Whence::Begin);
+
+  skip = (size_t)(begin - pos);
+  remaining = end < 0 ? -1 : (end > pos ? end - pos : 0);
+  drained = false;
+  curr = cache;
+  this->end = cache;
+  tkprev = cache;
+}
+
+// Hands the cache over to the caller along with where its unparsed bytes are
+// and whether they are the last of the file, the reader is left without one.
+CSV_Cache* CSVFileReader::detach(size_t& off, size_t& len, bool& last) {
+  CSV_Cache* ck = chunk;
+  off = tkprev - cache;
+  len = end - tkprev;
+  last = drained;
+
+  chunk = nullptr;
+  cache = nullptr;
+  tkprev = nullptr;
+  curr = nullptr;
+  end = nullptr;
+  return ck;
+}
+
+// Continues in a cache detached from another reader of the same file, the
+// file has to be positioned right after its unparsed bytes.
+void CSVFileReader::attach(CSV_Cache* ck, size_t off, size_t len, bool last) {
+  if(chunk != nullptr)
+    CSV_CachePool::get().release(chunk);
+
+  chunk = ck;
+  cache = ck->mem;
+  tkprev = cache + off;
+  curr = tkprev;
+  end = tkprev + len;
+  drained = last;
+  skip = 0;
+  remaining = -1;
+}
+
+// Presents an already loaded block of memory through the same interface as
+// the CSVFileReader so that the parsers can run on it directly.
+// The parsers load 64 bytes at a time which means that at least 64 bytes
+// past end must be readable, their contents are ignored.
+class CSVMemReader {
+public:
+  CSVMemReader(char* begin, char* end) :
+    begin(begin), curr(begin), end(end), tkprev(begin) {}
+
+  char* pushCache(Error& err, size_t sz, uint64_t& read);
+  void settk(char* tk) { tkprev = tk; }
+  char* getCurr() const { return curr; }
+  char* getPrev() const { return tkprev; }
+  bool eof() const { return curr >= end; }
+  CSV_Cache* getChunk() const { return nullptr; }
+
+  void seek(Error& err, int64_t off, Whence wh = Whence::Current) {}
+  bool isOpen() const { return true; }
+  size_t getCacheAlignment() const { return 64; }
+  size_t getCacheSize() const { return 64 + (end - begin) / 64 * 64; }
+
+  int64_t getRemBytes() const { return end - tkprev; }
+
+  bool hasDangling() const { return eof() && tkprev < end; }
+  std::string_view getDangling() const { return std::string_view(tkprev, end - tkprev); }
+
+private:
+  char* begin;
+  char* curr;
+  char* end;
+  char* tkprev;
+};
+
+char* CSVMemReader::pushCache(Error& err, size_t sz, uint64_t& read) {
+  ptrdiff_t avail = end - curr;
+  read = avail <= 0 ? 0 : (avail < (ptrdiff_t)sz ? avail : sz);
+
   char* res = curr;
   curr += sz;
   return res;
@@ -233,6 +439,38 @@ WK_FORCE_INLINE uint64_t andn_x64(uint64_t a, uint64_t b) {
 
 typedef uint64_t(andnSig)(uint64_t, uint64_t);
 
+// Count the set bits using the popcnt instruction (ABM on amd, SSE4.2 era on intel).
+// This function has to exist for the same reason as tzcnt_bmi.
+WK_FORCE_INLINE uint64_t popcnt_abm(uint64_t v) {
+  return _mm_popcnt_u64(v);
+}
+
+// Count the set bits using regular x64 instructions.
+WK_FORCE_INLINE uint64_t popcnt_x64(uint64_t v) {
+  v = v - ((v >> 1) & 0x5555555555555555);
+  v = (v & 0x3333333333333333) + ((v >> 2) & 0x3333333333333333);
+  v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0f;
+  return (v * 0x0101010101010101) >> 56;
+}
+
+typedef uint64_t(popcntSig)(uint64_t);
+
+// Returns the position of the k-th (from zero) set bit, the bit is deposited
+// onto the k-th set bit of v using the BMI2 pdep instruction.
+WK_FORCE_INLINE uint64_t select_bmi2(uint64_t v, uint64_t k) {
+  return _tzcnt_u64(_pdep_u64(1ull << k, v));
+}
+
+// Returns the position of the k-th (from zero) set bit by clearing the ones before it.
+WK_FORCE_INLINE uint64_t select_x64(uint64_t v, uint64_t k) {
+  for(; k > 0; k--) {
+    v &= v - 1;
+  }
+  return tzcnt_x64(v);
+}
+
+typedef uint64_t(selectSig)(uint64_t, uint64_t);
+
 // This csv parser implements an finite state machine in order to parse a file.
 // This implementation differs from the other implementations in how it deals with
 // escape characters, because here the proceeding backslash is removed.
@@ -349,60 +587,133 @@ Error& readCSV(Error& err, F& clb, uint32_t& row, uint32_t& column, char seperat
   return err;
 }
 
-// This function is the base implementation of the csv parser.
-// It is parsing and invoking the callback once it finds a token.
-// The template argument rtnOnNL is spelled out to Return On NewLine
-// When set to true the function will return after a single newline
-// character has been found.
-// function returns true if rtnOnNL is true and an newline was encountered.
-// The other two template arguments, tzcnt and andn, can be one of
-// tzcnt_bmi, tzcnt_x64, andn_bmi or andn_x64 depending on architecture.
-// The function arguments ctx is the current context this parser is in.
-// The read argument is the amount of bytes successfully read and as such no
-// more than read bytes should be parsed from the context.
-// (yes a *minor* code explosion is taking place here)
-template<bool rtnOnNL, tzcntSig tzcnt, andnSig andn, typename F>
-bool readCSV_Impl(Error& err, F& clb, CSV_Context& ctx, uint64_t read, CSVFileReader& reader) {
-  CSVReader::Token tk = std::string_view();
+// Builds the masks of ctx from the 64 bytes at p using only x64 instructions.
+WK_FORCE_INLINE void masks_x64(CSV_Context& ctx, const char* p, char seperator) {
+  ctx.sep_mask = 0;
+  ctx.quote_mask = 0;
+  ctx.esc_mask = 0;
+  ctx.nl_mask = 0;
+
+  for(int i = 0; i < 64; i++) {
+    char c = p[i];
+    ctx.sep_mask |= (uint64_t)(c == seperator) << i;
+    ctx.quote_mask |= (uint64_t)(c == '\"') << i;
+    ctx.esc_mask |= (uint64_t)(c == '\\') << i;
+    ctx.nl_mask |= (uint64_t)(c == '\n') << i;
+  }
+}
+
+// Builds the masks of ctx from the 64 bytes at p using sse and sse2.
+WK_FORCE_INLINE void masks_SSE2(CSV_Context& ctx, const char* p, char seperator) {
+  __m128i sep = _mm_set1_epi8(seperator);
+  __m128i esc = _mm_set1_epi8('\\');
+  __m128i quote = _mm_set1_epi8('\"');
+  __m128i nl = _mm_set1_epi8('\n');
+
+  ctx.sep_mask = 0;
+  ctx.quote_mask = 0;
+  ctx.esc_mask = 0;
+  ctx.nl_mask = 0;
+
+  for(int i = 0; i < 4; i++) {
+    __m128i strBuff = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+
+    __m128i sepField = _mm_cmpeq_epi8(sep, strBuff);
+    __m128i quoteField = _mm_cmpeq_epi8(quote, strBuff);
+    __m128i escField = _mm_cmpeq_epi8(esc, strBuff);
+    __m128i nlField = _mm_cmpeq_epi8(nl, strBuff);
+
+    ctx.sep_mask |= (uint64_t)((uint32_t)_mm_movemask_epi8(sepField)) << (16 * i);
+    ctx.quote_mask |= (uint64_t)((uint32_t)_mm_movemask_epi8(quoteField)) << (16 * i);
+    ctx.esc_mask |= (uint64_t)((uint32_t)_mm_movemask_epi8(escField)) << (16 * i);
+    ctx.nl_mask |= (uint64_t)((uint32_t)_mm_movemask_epi8(nlField)) << (16 * i);
+  }
+}
+
+// Builds the masks of ctx from the 64 bytes at p using avx and avx2.
+WK_FORCE_INLINE void masks_AVX2(CSV_Context& ctx, const char* p, char seperator) {
+  __m256i sep = _mm256_set1_epi8(seperator);
+  __m256i esc = _mm256_set1_epi8('\\');
+  __m256i quote = _mm256_set1_epi8('\"');
+  __m256i nl = _mm256_set1_epi8('\n');
+
+  ctx.sep_mask = 0;
+  ctx.quote_mask = 0;
+  ctx.esc_mask = 0;
+  ctx.nl_mask = 0;
+
+  for(int i = 0; i < 2; i++) {
+    __m256i strBuff = _mm256_loadu_si256((const __m256i*)(p + 32 * i));
 
+    __m256i sepField = _mm256_cmpeq_epi8(sep, strBuff);
+    __m256i quoteField = _mm256_cmpeq_epi8(quote, strBuff);
+    __m256i escField = _mm256_cmpeq_epi8(esc, strBuff);
+    __m256i nlField = _mm256_cmpeq_epi8(nl, strBuff);
+
+    ctx.sep_mask |= (uint64_t)((uint32_t)_mm256_movemask_epi8(sepField)) << (32 * i);
+    ctx.quote_mask |= (uint64_t)((uint32_t)_mm256_movemask_epi8(quoteField)) << (32 * i);
+    ctx.esc_mask |= (uint64_t)((uint32_t)_mm256_movemask_epi8(escField)) << (32 * i);
+    ctx.nl_mask |= (uint64_t)((uint32_t)_mm256_movemask_epi8(nlField)) << (32 * i);
+  }
+}
+
+typedef void(masksSig)(CSV_Context&, const char*, char);
+
+// Returns the characters escaped by the backslashes in bs, carry tells whether
+// the first character is escaped by the previous block and is updated for the
+// next one. The backslash of an escaped backslash escapes nothing.
+WK_FORCE_INLINE uint64_t findEscaped(uint64_t bs, uint64_t& carry) {
+  const uint64_t even = 0x5555555555555555;
+
+  bs &= ~carry;
+  uint64_t follows = bs << 1 | carry;
+  uint64_t odd_starts = bs & ~even & ~follows;
+
+  uint64_t starts_even = odd_starts + bs;
+  carry = starts_even < odd_starts;
+
+  return (even ^ (starts_even << 1)) & follows;
+}
+
+// Resolves the escape and quote masks of the current block.
+// Escaped quotes are removed from the quote_mask, the esc and quote carries
+// are updated for the next block and the returned value is the quote fill,
+// a mask of every byte inside quotes (the quotes themselves excluded).
+// The read argument is the amount of valid bytes in the block.
+template<andnSig andn>
+WK_FORCE_INLINE uint64_t quoteFill(CSV_Context& ctx, uint64_t read) {
   // Since the amount of data read can be less than the expected 64
   // so must any dangling bits be cleared.
   // A bit less intuitivly but equally true, this clearing also
   // ensures that all data read in the do while loop later on is valid.
-  uint64_t read_mask = 0xffffffffffffffff >> (64 - read);
+  uint64_t read_mask = read >= 64 ? 0xffffffffffffffff : WK_BIT(read) - 1;
   ctx.esc_mask &= read_mask;
   ctx.nl_mask &= read_mask;
   ctx.quote_mask &= read_mask;
   ctx.sep_mask &= read_mask;
 
   uint64_t quote_mask_fill;
-  // since the last bit in the esc_mask is useless (in this iteration) due to the fact
-  // that a backslash by definition proceeds something.
-  // So whats being done here is the esc_carry from the last iteration is inserted here.
-  // the current esc_mask must be shifted since the esc_carry might escape a backslash in
-  // the current iteration
-  uint64_t esc_cpy = ctx.esc_mask << 1 | ctx.esc_carry;
-
-  // TODO: fix esc_carry, an esc_carry should only be generated if the below magic statement overflows.
-  ctx.esc_carry = 0;
 
   // Now now, This is going to be explained, somehow, alright it's blood magic this expression
   // references here https://youtu.be/wlvKAT7SZIQ?t=2029
-  // It's somewhere in the code at simdjson's github but I don't know where.
   // What it does is it takes the all the backslashes and tell which character is escaped and which isn't
   // An example
   //  strBuff => "\\\"Nam[{": [ 116,"\\\\"
   // esc_mask => _111________________1111_
-  //  esc_cpy => ____1____________________
-  auto ovfDetect = [&ctx](uint64_t a, uint64_t b) -> uint64_t {
-    uint64_t sum = a + b;
-    ctx.esc_carry |= (sum < a);
-    return sum;
-  };
-  // when this statement takes 5% of this functions runtime you know it's pretty darn optimized.
-  esc_cpy = andn(0xaaaaaaaaaaaaaaaa, andn(esc_cpy, ovfDetect(esc_cpy, (andn(esc_cpy << 1, esc_cpy) & 0xaaaaaaaaaaaaaaaa)))) |
-    (andn(esc_cpy, ovfDetect(esc_cpy, (andn(esc_cpy << 1, esc_cpy) & 0x5555555555555555))) & 0xaaaaaaaaaaaaaaaa);
-  ctx.esc_mask = esc_cpy >> 1;
+  //  escaped => __1_1________________1_1_
+  uint64_t esc_carry = ctx.esc_carry;
+  uint64_t escaped = findEscaped(ctx.esc_mask, esc_carry);
+
+  // The bits past a partial block are clear, so a backslash escaping the byte
+  // after the last one shows up as the first bit past it rather than carrying
+  // out of the block. Partial blocks turn up mid-stream as well, wherever a
+  // read or range did not begin on a whole block.
+  if(read < 64) {
+    esc_carry = (escaped >> read) & 1;
+    escaped &= read_mask;
+  }
+  ctx.esc_carry = esc_carry;
+  ctx.esc_mask = escaped;
 
   // Remove any escaped quotes from the mask
   ctx.quote_mask = andn(ctx.esc_mask, ctx.quote_mask);
@@ -413,7 +724,7 @@ bool readCSV_Impl(Error& err, F& clb, CSV_Context& ctx, uint64_t read, CSVFileRe
   //    strBuff => CSV,"Yay","Comments",take,"too",long,"to",write
   // quote_mask => ____1___1_1________1______1___1______1__1______
   // quote_fill => ____11111_1111111111______11111______1111______
-  quote_mask_fill = ctx.quote_mask | ctx.quote_carry;
+  quote_mask_fill = ctx.quote_mask;
   quote_mask_fill = quote_mask_fill ^ (quote_mask_fill << 1);
   quote_mask_fill = quote_mask_fill ^ (quote_mask_fill << 2);
   quote_mask_fill = quote_mask_fill ^ (quote_mask_fill << 4);
@@ -421,6 +732,15 @@ bool readCSV_Impl(Error& err, F& clb, CSV_Context& ctx, uint64_t read, CSVFileRe
   quote_mask_fill = quote_mask_fill ^ (quote_mask_fill << 16);
   quote_mask_fill = quote_mask_fill ^ (quote_mask_fill << 32);
 
+  // The quote_carry inverts the whole block rather than being or:ed into
+  // the first bit, or'ing would lose a closing quote in the very first byte.
+  quote_mask_fill ^= 0 - ctx.quote_carry;
+
+  // is the last bit inside quotes? is so it carries into
+  // the next iteration. This has to be taken before the quotes
+  // are removed or an opening quote in the last byte would be lost.
+  ctx.quote_carry = quote_mask_fill >> 63;
+
   // since the actual quote characters are of no use they are removed
   // An example
   //    strBuff => CSV,"Yay","Comments",take,"too",long,"to",write
@@ -428,14 +748,42 @@ bool readCSV_Impl(Error& err, F& clb, CSV_Context& ctx, uint64_t read, CSVFileRe
   // quote_fill => _____111___11111111________111________11_______
   quote_mask_fill = andn(ctx.quote_mask, quote_mask_fill);
 
+  return quote_mask_fill;
+}
+
+// Returns the token spanning [b, e) with its enclosing quotes removed.
+// Every token goes through here whatever block it began in, so a token comes
+// out the same no matter where the block boundaries fall.
+WK_FORCE_INLINE std::string_view spanToken(const char* b, const char* e) {
+  if(e - b >= 2 && *b == '\"' && e[-1] == '\"')
+    return std::string_view(b + 1, e - b - 2);
+  return std::string_view(b, e - b);
+}
+
+// This function is the base implementation of the csv parser.
+// It is parsing and invoking the callback once it finds a token.
+// The template argument rtnOnNL is spelled out to Return On NewLine
+// When set to true the function will return after a single newline
+// character has been found.
+// function returns true if rtnOnNL is true and an newline was encountered.
+// The other two template arguments, tzcnt and andn, can be one of
+// tzcnt_bmi, tzcnt_x64, andn_bmi or andn_x64 depending on architecture.
+// The function arguments ctx is the current context this parser is in.
+// The read argument is the amount of bytes successfully read and as such no
+// more than read bytes should be parsed from the context.
+// The reader is either a CSVFileReader or anything with the same interface.
+// (yes a *minor* code explosion is taking place here)
+template<bool rtnOnNL, tzcntSig tzcnt, andnSig andn, typename F, typename R>
+bool readCSV_Impl(Error& err, F& clb, CSV_Context& ctx, uint64_t read, R& reader) {
+  CSV_Cache* chunk = reader.getChunk();
+  CSVReader::Token tk = std::string_view();
+
+  uint64_t quote_mask_fill = quoteFill<andn>(ctx, read);
+
   // remove any seperation or newlines inside quotes
   ctx.sep_mask = andn(quote_mask_fill, ctx.sep_mask);
   ctx.nl_mask = andn(quote_mask_fill, ctx.nl_mask);
 
-  // is the last bit inside quotes? is so it carries into
-  // the next iteration
-  ctx.quote_carry = quote_mask_fill >> 63;
-
   // This here is what parses out the tokens from strBuff using
   // the masks that have been computed previously.
   // It also invokes the func on any token found.
@@ -444,50 +792,29 @@ bool readCSV_Impl(Error& err, F& clb, CSV_Context& ctx, uint64_t read, CSVFileRe
   uint64_t next_sep;
   // the amount of bits in the nl_mask until the next set bit, or 64
   uint64_t next_nl;
-  // the amount of bits in the quote_mask_fill until the next set bit, or 64
-  uint64_t next_quote;
-  // the amount of set bits counted from next_quote in the quote_mask_fill mask, or 0
-  uint64_t quote_len;
 
-  uint64_t prev = 0;
   char* tk_start;
   char* p_rel = reader.getCurr() - 64;
 
   do {
     next_sep   = tzcnt(ctx.sep_mask);
     next_nl    = tzcnt(ctx.nl_mask);
-    next_quote = tzcnt(quote_mask_fill >> prev) + prev;
-    quote_len  = tzcnt(~(quote_mask_fill >> next_quote));
 
     tk_start = reader.getPrev();
 
     if(next_sep < next_nl && next_sep < 64) {
-      if(next_quote < next_sep) {
-        tk = std::string_view(p_rel + next_quote, quote_len);
-      }
-      else {
-        tk = std::string_view(tk_start, p_rel + next_sep - tk_start);
-      }
+      tk = CSVReader::Token(spanToken(tk_start, p_rel + next_sep), chunk);
       clb(err, ctx.row, ctx.column, tk);
       ctx.column++;
-      prev = next_sep + 1;
       reader.settk(p_rel + next_sep + 1);
       // clears the sep_mask so that we don't find this same instance on the next iteration
       ctx.sep_mask = andn(WK_BIT(next_sep), ctx.sep_mask);
     }
     else if(next_nl < 64) {
-      if(next_quote < next_nl) {
-        tk = std::string_view(p_rel + next_quote, quote_len);
-        //ctx.mem.writebin(err, ctx.strBuff + next_quote, quote_len);
-      }
-      else {
-        tk = std::string_view(tk_start, p_rel + next_nl - tk_start);
-        //ctx.mem.writebin(err, ctx.strBuff + prev, next_nl - prev);
-      }
+      tk = CSVReader::Token(spanToken(tk_start, p_rel + next_nl), chunk);
       clb(err, ctx.row, ctx.column, tk);
       ctx.row++;
       ctx.column = 0;
-      prev = next_nl + 1;
       reader.settk(p_rel + next_nl + 1);
       // clears the nl_mask so that we don't find this same instance on the next iteration
       ctx.nl_mask = andn(WK_BIT(next_nl), ctx.nl_mask);
@@ -499,15 +826,7 @@ bool readCSV_Impl(Error& err, F& clb, CSV_Context& ctx, uint64_t read, CSVFileRe
       }
     }
     else {
-      //// if no delimiter was found copy the data into the buffer and exit.
-      //if(next_quote < 64) {
-      //  //ctx.mem.writebin(err, ctx.strBuff + next_quote, quote_len);
-      //  reader.settk(p_rel + next_quote);
-      //}
-      //else {
-      //  //ctx.mem.writebin(err, ctx.strBuff + prev, read - prev);
-      //  reader.settk(p_rel + prev);
-      //}
+      // no delimiter left in the block, the token goes on in the next one.
       break;
     }
   } while(true);
@@ -517,8 +836,8 @@ bool readCSV_Impl(Error& err, F& clb, CSV_Context& ctx, uint64_t read, CSVFileRe
 
 // parses an csv file depending using only x64 and optionally bmi1
 // rtnOnNL decides whether or not to return on the first encountered newline
-template<bool rtnOnNL, tzcntSig tzcnt, andnSig andn, typename F>
-Error& readCSV_bmi1(Error& err, F& clb, uint32_t& row, uint32_t& column, char seperator, CSVFileReader& reader) {
+template<bool rtnOnNL, tzcntSig tzcnt, andnSig andn, typename F, typename R>
+Error& readCSV_bmi1(Error& err, F& clb, uint32_t& row, uint32_t& column, char seperator, R& reader) {
   if(!err.peekOk())
     return err;
 
@@ -527,26 +846,12 @@ Error& readCSV_bmi1(Error& err, F& clb, uint32_t& row, uint32_t& column, char se
     return err;
   }
 
-  char sep = seperator;
-  char esc = '\\';
-  char quote = '\"';
-  char nl = '\n';
-
   CSV_Context ctx(row, column);
 
   uint64_t read = 0;
 
   while(!reader.eof() && err.peekOk()) {
-    for(int i = 0; i < 64; i++) {
-      uint64_t rn = 0;
-      char c = *reader.pushCache(err, 1, rn);
-      read += rn;
-
-      ctx.sep_mask |= (uint64_t)(c == sep) << i;
-      ctx.quote_mask |= (uint64_t)(c == quote) << i;
-      ctx.esc_mask |= (uint64_t)(c == esc) << i;
-      ctx.nl_mask |= (uint64_t)(c == nl) << i;
-    }
+    masks_x64(ctx, reader.pushCache(err, 64, read), seperator);
 
     if(readCSV_Impl<rtnOnNL, tzcnt, andn, F>(err, clb, ctx, read, reader)) {
       return err;
@@ -559,7 +864,8 @@ Error& readCSV_bmi1(Error& err, F& clb, uint32_t& row, uint32_t& column, char se
   //}
 
   if(reader.hasDangling()) {
-    CSVReader::Token tk = reader.getDangling();
+    std::string_view dangling = reader.getDangling();
+    CSVReader::Token tk(spanToken(dangling.data(), dangling.data() + dangling.size()), reader.getChunk());
     clb(err, row, column, tk);
   }
 
@@ -568,8 +874,8 @@ Error& readCSV_bmi1(Error& err, F& clb, uint32_t& row, uint32_t& column, char se
 
 // parses an csv file depending using only sse, sse2 and optionally bmi1
 // rtnOnNL decides whether or not to return on the first encountered newline
-template<bool rtnOnNL, tzcntSig tzcnt, andnSig andn, typename F>
-Error& readCSV_SSE2(Error& err, F& clb, uint32_t& row, uint32_t& column, char seperator, CSVFileReader& reader) {
+template<bool rtnOnNL, tzcntSig tzcnt, andnSig andn, typename F, typename R>
+Error& readCSV_SSE2(Error& err, F& clb, uint32_t& row, uint32_t& column, char seperator, R& reader) {
   if(!err.peekOk())
     return err;
 
@@ -578,11 +884,6 @@ Error& readCSV_SSE2(Error& err, F& clb, uint32_t& row, uint32_t& column, char se
     return err;
   }
 
-  __m128i sep = _mm_set1_epi8(seperator);
-  __m128i esc = _mm_set1_epi8('\\');
-  __m128i quote = _mm_set1_epi8('\"');
-  __m128i nl = _mm_set1_epi8('\n');
-
   CSV_Context ctx(row, column);
 
   uint64_t read = 0;
@@ -602,22 +903,7 @@ Error& readCSV_SSE2(Error& err, F& clb, uint32_t& row, uint32_t& column, char se
 
   if(readAligned) {
     while(!reader.eof() && err.peekOk()) {
-      read = 0;
-      for(int i = 0; i < 4; i++) {
-        uint64_t pushed = 0;
-        __m128i strBuff = _mm_load_si128((const __m128i*)reader.pushCache(err, 16, pushed));
-        read += pushed;
-
-        __m128i sepField = _mm_cmpeq_epi8(sep, strBuff);
-        __m128i quoteField = _mm_cmpeq_epi8(quote, strBuff);
-        __m128i escField = _mm_cmpeq_epi8(esc, strBuff);
-        __m128i nlField = _mm_cmpeq_epi8(nl, strBuff);
-
-        ctx.sep_mask |= (uint64_t)((uint32_t)_mm_movemask_epi8(sepField)) << (16 * i);
-        ctx.quote_mask |= (uint64_t)((uint32_t)_mm_movemask_epi8(quoteField)) << (16 * i);
-        ctx.esc_mask |= (uint64_t)((uint32_t)_mm_movemask_epi8(escField)) << (16 * i);
-        ctx.nl_mask |= (uint64_t)((uint32_t)_mm_movemask_epi8(nlField)) << (16 * i);
-      }
+      masks_SSE2(ctx, reader.pushCache(err, 64, read), seperator);
 
       if(readCSV_Impl<rtnOnNL, tzcnt, andn, F>(err, clb, ctx, read, reader)) {
         return err;
@@ -636,7 +922,8 @@ Error& readCSV_SSE2(Error& err, F& clb, uint32_t& row, uint32_t& column, char se
   //}
 
   if(reader.hasDangling()) {
-    CSVReader::Token tk = reader.getDangling();
+    std::string_view dangling = reader.getDangling();
+    CSVReader::Token tk(spanToken(dangling.data(), dangling.data() + dangling.size()), reader.getChunk());
     clb(err, row, column, tk);
   }
 
@@ -645,8 +932,8 @@ Error& readCSV_SSE2(Error& err, F& clb, uint32_t& row, uint32_t& column, char se
 
 // parses an csv file depending using only avx, avx2 and optionally bmi1
 // rtnOnNL decides whether or not to return on the first encountered newline
-template<bool rtnOnNL, tzcntSig tzcnt, andnSig andn, typename F>
-Error& readCSV_AVX2(Error& err, F& clb, uint32_t& row, uint32_t& column, char seperator, CSVFileReader& reader) {
+template<bool rtnOnNL, tzcntSig tzcnt, andnSig andn, typename F, typename R>
+Error& readCSV_AVX2(Error& err, F& clb, uint32_t& row, uint32_t& column, char seperator, R& reader) {
   if(!err.peekOk())
     return err;
 
@@ -655,11 +942,6 @@ Error& readCSV_AVX2(Error& err, F& clb, uint32_t& row, uint32_t& column, char se
     return err;
   }
 
-  __m256i sep = _mm256_set1_epi8(seperator);
-  __m256i esc = _mm256_set1_epi8('\\');
-  __m256i quote = _mm256_set1_epi8('\"');
-  __m256i nl = _mm256_set1_epi8('\n');
-
   CSV_Context ctx(row, column);
 
   uint64_t read = 0;
@@ -670,22 +952,7 @@ Error& readCSV_AVX2(Error& err, F& clb, uint32_t& row, uint32_t& column, char se
 
   if(readAligned) {
     while(!reader.eof() && err.peekOk()) {
-      read = 0;
-      for(int i = 0; i < 2; i++) {
-        uint64_t pushed = 0;
-        __m256i strBuff = _mm256_load_si256((const __m256i*)reader.pushCache(err, 32, pushed));
-        read += pushed;
-
-        __m256i sepField = _mm256_cmpeq_epi8(sep, strBuff);
-        __m256i quoteField = _mm256_cmpeq_epi8(quote, strBuff);
-        __m256i escField = _mm256_cmpeq_epi8(esc, strBuff);
-        __m256i nlField = _mm256_cmpeq_epi8(nl, strBuff);
-
-        ctx.sep_mask |= (uint64_t)((uint32_t)_mm256_movemask_epi8(sepField)) << (32 * i);
-        ctx.quote_mask |= (uint64_t)((uint32_t)_mm256_movemask_epi8(quoteField)) << (32 * i);
-        ctx.esc_mask |= (uint64_t)((uint32_t)_mm256_movemask_epi8(escField)) << (32 * i);
-        ctx.nl_mask |= (uint64_t)((uint32_t)_mm256_movemask_epi8(nlField)) << (32 * i);
-      }
+      masks_AVX2(ctx, reader.pushCache(err, 64, read), seperator);
 
       if(readCSV_Impl<rtnOnNL, tzcnt, andn, F>(err, clb, ctx, read, reader)) {
         return err;
@@ -704,7 +971,8 @@ Error& readCSV_AVX2(Error& err, F& clb, uint32_t& row, uint32_t& column, char se
   //}
 
   if(reader.hasDangling()) {
-    CSVReader::Token tk = reader.getDangling();
+    std::string_view dangling = reader.getDangling();
+    CSVReader::Token tk(spanToken(dangling.data(), dangling.data() + dangling.size()), reader.getChunk());
     clb(err, row, column, tk);
   }
 
@@ -730,7 +998,15 @@ Error& CSVReader::readHeader(Error& err, F& clb) {
     { dcsv::readCSV_SSE2<true, dcsv::tzcnt_x64, dcsv::andn_x64, F>, CPU::ISA::sse2 | CPU::ISA::sse },
     { dcsv::readCSV_bmi1<true, dcsv::tzcnt_x64, dcsv::andn_x64, F>, 0 }
   };
-  return dispatchHeader(err, clb, row, column, seperator, cread);
+  unpark();
+  dispatchHeader(err, clb, row, column, seperator, cread);
+
+  // the header ended before the cache did, read picks up the rest of it.
+  if(err.peekOk() && !cread.eof()) {
+    parked.cache = cread.detach(parked.off, parked.len, parked.last);
+    parked.at = reader.tell();
+  }
+  return err;
 }
 
 // Runtime dispatch, select one of the defined functions (most restrictive first)
@@ -739,7 +1015,44 @@ Error& CSVReader::readHeader(Error& err, F& clb) {
 template<typename F>
 Error& CSVReader::read(Error& err, F& clb) {
   namespace dcsv = detail::csv;
+
+  // only the plain read at the end continues in the cache left by readHeader.
+  if(skip_rows > 0 || row_limit > 0 || pipeline_depth > 0 || read_ahead > 0)
+    unpark();
+
+  if(skip_rows > 0 || row_limit > 0)
+    return readWindow(err, clb);
+
+  if(pipeline_depth > 0)
+    return readPipelined(err, clb);
+
+  if(read_ahead > 0) {
+    dcsv::CSVPrefetchReader pread(reader, req_alignment, read_ahead);
+    static RuntimeDispatch<Error&(Error&, F&, uint32_t&, uint32_t&, char, dcsv::CSVPrefetchReader&)> dispatchPrefetch{
+      { dcsv::readCSV_AVX2<false, dcsv::tzcnt_bmi, dcsv::andn_bmi, F>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 },
+      { dcsv::readCSV_SSE2<false, dcsv::tzcnt_bmi, dcsv::andn_bmi, F>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 },
+      { dcsv::readCSV_bmi1<false, dcsv::tzcnt_bmi, dcsv::andn_bmi, F>, CPU::ISA::bmi1 },
+      { dcsv::readCSV_AVX2<false, dcsv::tzcnt_x64, dcsv::andn_x64, F>, CPU::ISA::avx2 | CPU::ISA::avx },
+      { dcsv::readCSV_SSE2<false, dcsv::tzcnt_x64, dcsv::andn_x64, F>, CPU::ISA::sse2 | CPU::ISA::sse },
+      { dcsv::readCSV_bmi1<false, dcsv::tzcnt_x64, dcsv::andn_x64, F>, 0 }
+    };
+    return dispatchPrefetch(err, clb, row, column, seperator, pread);
+  }
+
+  // a resumed read may begin anywhere but unbuffered reads have to be aligned.
   dcsv::CSVFileReader cread(reader, req_alignment);
+  int64_t pos = reader.tell();
+  if(parked.cache != nullptr && parked.at == pos) {
+    cread.attach(parked.cache, parked.off, parked.len, parked.last);
+    reader.seek(err, pos + (int64_t)parked.len, Whence::Begin);
+    parked.cache = nullptr;
+  }
+  else {
+    unpark();
+    if(pos % (int64_t)req_alignment != 0)
+      cread.setRange(err, pos);
+  }
+
   static RuntimeDispatch<Error&(Error&, F&, uint32_t&, uint32_t&, char, dcsv::CSVFileReader&)> dispatch{
     { dcsv::readCSV_AVX2<false, dcsv::tzcnt_bmi, dcsv::andn_bmi, F>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 },
     { dcsv::readCSV_SSE2<false, dcsv::tzcnt_bmi, dcsv::andn_bmi, F>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 },
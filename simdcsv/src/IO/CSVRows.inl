@@ -0,0 +1,332 @@
+#include <chrono>
+
+namespace Wikinger {
+namespace detail {
+namespace csv {
+
+// Appends only the newlines outside of quotes in [from, to) to idx, otherwise
+// the same as indexBlocks.
+template<masksSig masks, tzcntSig tzcnt, andnSig andn>
+size_t indexNewlines(CSV_Context& ctx, const char* mem, size_t from, size_t to, bool last, char seperator, std::vector<uint32_t, StdAllocator<uint32_t>>& idx) {
+  size_t i = from;
+  for(; i < to && (i + 64 <= to || last); i += 64) {
+    masks(ctx, mem + i, seperator);
+    uint64_t fill = quoteFill<andn>(ctx, to - i);
+    uint64_t nl = andn(fill, ctx.nl_mask);
+
+    for(; nl != 0; nl &= nl - 1) {
+      idx.push_back((uint32_t)(i + tzcnt(nl)) | CSV_IndexNL);
+    }
+  }
+  return i < to ? i : to;
+}
+
+// Returns the best indexNewlines available on this cpu.
+indexSig* selectNewlines() {
+  static RuntimeDispatch<indexSig> dispatch{
+    { indexNewlines<masks_AVX2, tzcnt_bmi, andn_bmi>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 },
+    { indexNewlines<masks_SSE2, tzcnt_bmi, andn_bmi>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 },
+    { indexNewlines<masks_x64, tzcnt_bmi, andn_bmi>, CPU::ISA::bmi1 },
+    { indexNewlines<masks_AVX2, tzcnt_x64, andn_x64>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { indexNewlines<masks_SSE2, tzcnt_x64, andn_x64>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { indexNewlines<masks_x64, tzcnt_x64, andn_x64>, 0 }
+  };
+  return dispatch.get();
+}
+
+} // namespace csv
+} // namespace detail
+
+
+// A view of a single row, the tokens point into the buffer of the CSVRows
+// it came from and are only valid until the iteration moves on.
+// Rows of lazy CSVRows are split into columns on their first access.
+class CSVRow {
+public:
+  CSVRow() : mem(nullptr), delims(nullptr), count(0), begin(0), end(0), row(0), offset(0), lazy(nullptr) {}
+  CSVRow(const char* m, const uint32_t* d, uint32_t n, size_t b, size_t e, uint32_t r, int64_t off, CSVRows* l = nullptr) :
+    mem(m), delims(d), count(n), begin(b), end(e), row(r), offset(off), lazy(l) {}
+
+  size_t size() const {
+    if(lazy != nullptr)
+      split();
+    return (size_t)count + 1;
+  }
+
+  uint32_t getRow() const { return row; }
+
+  // The file offset the row begins at.
+  int64_t getOffset() const { return offset; }
+
+  // The bytes of the whole row without its newline, available without splitting it.
+  std::string_view getText() const { return std::string_view(mem + begin, end - begin); }
+
+  CSVReader::Token operator[](size_t col) const {
+    if(lazy != nullptr)
+      split();
+
+    size_t b = col == 0 ? begin : delims[col - 1] + 1;
+    size_t e = col == count ? end : delims[col];
+    return CSVReader::Token(detail::csv::spanToken(mem + b, mem + e));
+  }
+
+private:
+  friend class CSVRows;
+
+  void split() const;
+
+  const char* mem;
+  mutable const uint32_t* delims;
+  mutable uint32_t count;
+  size_t begin;
+  size_t end;
+  uint32_t row;
+  int64_t offset;
+  mutable CSVRows* lazy;
+};
+
+// Pulls rows out of the file one at a time, for use in a range based for.
+// The state the kernel needs to resume is kept here instead of on the stack,
+// a buffer of whole rows is indexed at once and the rows are then handed out
+// from that index, the unfinished row at its end is moved to the front of
+// the buffer before the next read.
+// Iteration stops early on an error, which is left in the error passed to rows.
+// Lazy rows only index the newlines of the buffer, a row is split into its
+// columns by running the mask stage over it again once a column is accessed.
+// Rows which are passed over after looking at their text are never split.
+class CSVRows {
+public:
+  class iterator {
+  public:
+    iterator(CSVRows* r) : rows(r) {}
+
+    const CSVRow& operator*() const { return rows->curr; }
+    const CSVRow* operator->() const { return &rows->curr; }
+
+    iterator& operator++() {
+      if(!rows->next())
+        rows = nullptr;
+      return *this;
+    }
+
+    bool operator==(const iterator& other) const { return rows == other.rows; }
+    bool operator!=(const iterator& other) const { return rows != other.rows; }
+
+  private:
+    CSVRows* rows;
+  };
+
+  CSVRows(Error& err, UnbufferedFileReader& base, size_t alignment, char seperator, uint32_t& row, bool lazy = false);
+  CSVRows(const CSVRows&) = delete;
+  ~CSVRows();
+
+  iterator begin() { return iterator(next() ? this : nullptr); }
+  iterator end() { return iterator(nullptr); }
+
+  bool next();
+
+  CSVCheckpoint getCheckpoint() const;
+  void setCheckpointInterval(uint64_t bytes, uint32_t ms);
+  bool checkpoint(CSVCheckpoint& cp);
+
+private:
+  friend class CSVRow;
+
+  bool refill();
+  void split(const CSVRow& r);
+
+  Error& err;
+  UnbufferedFileReader& reader;
+  size_t alignment;
+  size_t size;
+  char seperator;
+  detail::csv::indexSig* index;
+  detail::csv::indexSig* splitter;
+
+  uint32_t& row;
+  uint32_t column;
+  detail::csv::CSV_Context ctx;
+
+  char* mem;
+  size_t cap;
+  size_t len;
+  bool last;
+  std::vector<uint32_t, StdAllocator<uint32_t>> idx;
+  std::vector<uint32_t, StdAllocator<uint32_t>> carried;
+  std::vector<uint32_t, StdAllocator<uint32_t>> cols;
+
+  // Where the next row begins and its first delimiter, pending is the
+  // amount of bytes at the end of the buffer not indexed yet.
+  size_t tk;
+  size_t i;
+  size_t pending;
+  size_t skip;
+
+  // The file offsets of the next read and of the beginning of the buffer.
+  int64_t pos;
+  int64_t base;
+
+  uint64_t cp_bytes;
+  uint32_t cp_ms;
+  int64_t cp_offset;
+  std::chrono::steady_clock::time_point cp_time;
+  bool cp_due;
+
+  CSVRow curr;
+};
+
+CSVRows::CSVRows(Error& e, UnbufferedFileReader& base, size_t _alignment, char sep, uint32_t& r, bool lazy) :
+  err(e), reader(base), alignment(_alignment), size(0), seperator(sep),
+  index(lazy ? detail::csv::selectNewlines() : detail::csv::selectIndex()),
+  splitter(lazy ? detail::csv::selectIndex() : nullptr), row(r), column(0), ctx(r, column),
+  mem(nullptr), cap(0), len(0), last(false), tk(0), i(0), pending(0), skip(0),
+  pos(0), base(0), cp_bytes(0), cp_ms(0), cp_offset(0), cp_due(false) {
+  size = 1024 * 1024;
+  size = (1 + (size - 1) / alignment) * alignment;
+
+  if(!err.peekOk()) {
+    last = true;
+    return;
+  }
+
+  // unbuffered reads have to begin on an aligned offset.
+  int64_t at = reader.tell();
+  int64_t aligned = at - at % alignment;
+  skip = (size_t)(at - aligned);
+  reader.seek(err, aligned, Whence::Begin);
+  pos = aligned;
+}
+
+CSVRows::~CSVRows() {
+  if(mem != nullptr)
+    getAllocator().deallocate(mem, cap, alignment);
+}
+
+// Reads the next buffer and indexes it, all but the last buffer are cut
+// after their last newline.
+bool CSVRows::refill() {
+  namespace dcsv = detail::csv;
+
+  size_t carry = len - tk;
+  size_t head = carry == 0 ? 0 : (1 + (carry - 1) / alignment) * alignment;
+  size_t need = head + size + 64;
+
+  if(need > cap) {
+    size_t ncap = (1 + (need - 1) / alignment) * alignment;
+    char* nmem = (char*)getAllocator().allocate(ncap, alignment);
+    if(carry > 0)
+      memcpy(nmem + head - carry, mem + tk, carry);
+    if(mem != nullptr)
+      getAllocator().deallocate(mem, cap, alignment);
+    mem = nmem;
+    cap = ncap;
+  }
+  else {
+    memmove(mem + head - carry, mem + tk, carry);
+  }
+
+  size_t read = reader.readbin(err, mem + head, size);
+  base = pos - (int64_t)head;
+  pos += read;
+
+  if(cp_ms != 0 && std::chrono::steady_clock::now() - cp_time >= std::chrono::milliseconds(cp_ms))
+    cp_due = true;
+
+  tk = head - carry + skip;
+  len = head + read;
+  last = read < size || !err.peekOk();
+  i = 0;
+
+  idx.clear();
+  for(uint32_t e : carried) {
+    idx.push_back((uint32_t)(head - carry) + e);
+  }
+
+  size_t from = head - pending + skip;
+  skip = 0;
+  size_t scanned = index(ctx, mem, from, len, last, seperator, idx);
+
+  size_t keep = idx.size();
+  if(!last) {
+    while(keep > 0 && !(idx[keep - 1] & dcsv::CSV_IndexNL)) {
+      keep--;
+    }
+  }
+
+  size_t rest = keep == 0 ? tk : (idx[keep - 1] & ~dcsv::CSV_IndexNL) + 1;
+  carried.clear();
+  for(size_t k = keep; k < idx.size(); k++) {
+    carried.push_back(idx[k] - (uint32_t)rest);
+  }
+  idx.resize(keep);
+  pending = len - scanned;
+
+  return err.peekOk();
+}
+
+// Moves on to the next row, false once the file is exhausted.
+bool CSVRows::next() {
+  namespace dcsv = detail::csv;
+
+  while(i == idx.size() && !(last && tk < len)) {
+    if(last || !refill())
+      return false;
+  }
+
+  size_t j = i;
+  while(j < idx.size() && !(idx[j] & dcsv::CSV_IndexNL)) {
+    j++;
+  }
+
+  size_t e = j < idx.size() ? idx[j] & ~dcsv::CSV_IndexNL : len;
+  curr = CSVRow(mem, idx.data() + i, (uint32_t)(j - i), tk, e, row, base + (int64_t)tk, splitter == nullptr ? nullptr : this);
+
+  // rows without a newline only occur at the very end of the file.
+  if(j < idx.size()) {
+    row++;
+    i = j + 1;
+    tk = e + 1;
+  }
+  else {
+    i = j;
+    tk = len;
+  }
+  return true;
+}
+
+// Indexes the seperators of the row, the row begins outside of quotes.
+void CSVRows::split(const CSVRow& r) {
+  uint32_t rrow = 0;
+  uint32_t rcolumn = 0;
+  detail::csv::CSV_Context rctx(rrow, rcolumn);
+
+  cols.clear();
+  splitter(rctx, mem, r.begin, r.end, true, seperator, cols);
+
+  r.delims = cols.data();
+  r.count = (uint32_t)cols.size();
+  r.lazy = nullptr;
+}
+
+void CSVRow::split() const {
+  lazy->split(*this);
+}
+
+// Returns the rows of the file for iterating over them, see CSVRows.
+// Row numbers continue from any previous read.
+CSVRows CSVReader::rows(Error& err) {
+  if(!reader.isOpen() && err.peekOk())
+    WK_RAISE_ERR(err, NotOpen, "CSVReader: no file open to read");
+
+  return CSVRows(err, reader, req_alignment, seperator, row);
+}
+
+// Returns the rows of the file split into columns on demand, see CSVRows.
+CSVRows CSVReader::lazyRows(Error& err) {
+  if(!reader.isOpen() && err.peekOk())
+    WK_RAISE_ERR(err, NotOpen, "CSVReader: no file open to read");
+
+  return CSVRows(err, reader, req_alignment, seperator, row, true);
+}
+
+} // namespace Wikinger
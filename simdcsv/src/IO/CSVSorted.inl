@@ -0,0 +1,155 @@
+namespace Wikinger {
+namespace detail {
+namespace csv {
+
+// Orders two keys as text or as numbers. Keys which are not numbers are
+// ordered before all numbers, which keeps a header row in front of them.
+inline int compareKeys(std::string_view a, std::string_view b, bool numeric) {
+  if(numeric) {
+    double x, y;
+    bool nx = parseNumber(a, x);
+    bool ny = parseNumber(b, y);
+    if(nx && ny)
+      return x < y ? -1 : (x > y ? 1 : 0);
+    if(nx != ny)
+      return nx ? 1 : -1;
+  }
+  return a.compare(b) < 0 ? -1 : (a == b ? 0 : 1);
+}
+
+// Finds the first row beginning at or after at and leaves it in the chunk
+// as [data + b, data + e), the row is read along with the resync window so a
+// probe costs a single read unless the row is longer than what is left of it.
+template<masksSig masks, tzcntSig tzcnt, andnSig andn>
+int64_t probeRow(Error& err, UnbufferedFileReader& file, CSV_Chunk& ck, int64_t at, char seperator, size_t alignment, size_t& b, size_t& e) {
+  if(at <= 0) {
+    b = 0;
+    e = loadRow<masks, tzcnt, andn>(err, file, ck, 0, seperator, alignment);
+    return 0;
+  }
+
+  int64_t s = resyncRow<masks, tzcnt, andn>(err, file, ck, at, CSVReader::QuoteState::Unknown, seperator, alignment);
+  b = (size_t)(s - at);
+  if(b >= ck.len) {
+    e = b;
+    return s;
+  }
+
+  char* term = findRowEnd<masks, tzcnt, andn>(err, file, ck, b, 0, seperator, alignment);
+  e = term - ck.data;
+  return s;
+}
+
+} // namespace csv
+} // namespace detail
+
+// Returns the offset of the first row whose key column is not less than key,
+// or the size of the file when there is none. The file is bisected on bytes,
+// every probe finds the next row beginning after the middle and parses it.
+int64_t CSVReader::lowerBound(Error& err, uint32_t col, std::string_view key, bool numeric) {
+  namespace dcsv = detail::csv;
+
+  static RuntimeDispatch<int64_t(Error&, UnbufferedFileReader&, dcsv::CSV_Chunk&, int64_t, char, size_t, size_t&, size_t&)> dispatchProbe{
+    { dcsv::probeRow<dcsv::masks_AVX2, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 },
+    { dcsv::probeRow<dcsv::masks_SSE2, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 },
+    { dcsv::probeRow<dcsv::masks_x64, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::bmi1 },
+    { dcsv::probeRow<dcsv::masks_AVX2, dcsv::tzcnt_x64, dcsv::andn_x64>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { dcsv::probeRow<dcsv::masks_SSE2, dcsv::tzcnt_x64, dcsv::andn_x64>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { dcsv::probeRow<dcsv::masks_x64, dcsv::tzcnt_x64, dcsv::andn_x64>, 0 }
+  };
+
+  dcsv::indexSig* tokenize = dcsv::selectIndex();
+  dcsv::CSV_Chunk ck;
+  std::vector<uint32_t, StdAllocator<uint32_t>> idx;
+  uint32_t r = 0;
+  uint32_t c = 0;
+
+  // rows beginning before lo are less than key, found is the first row known
+  // not to be and there is no row beginning in [hi, found).
+  int64_t found = reader.size(err);
+  int64_t lo = 0;
+  int64_t hi = found;
+
+  while(lo < hi && err.peekOk()) {
+    int64_t mid = lo + (hi - lo) / 2;
+    size_t b, e;
+    int64_t s = dispatchProbe(err, reader, ck, mid, seperator, req_alignment, b, e);
+
+    if(s >= found) {
+      hi = mid;
+      continue;
+    }
+
+    dcsv::CSV_Context ctx(r, c);
+    idx.clear();
+    tokenize(ctx, ck.data, b, e, true, seperator, idx);
+
+    size_t n = idx.size();
+    if(n > 0 && (idx[n - 1] & dcsv::CSV_IndexNL)) {
+      n--;
+      e = idx[n] & ~dcsv::CSV_IndexNL;
+    }
+
+    CSVRow probe(ck.data, idx.data(), (uint32_t)n, b, e, 0, s);
+    std::string_view tk = col < probe.size() ? probe[col].get<std::string_view>(err) : std::string_view();
+
+    if(dcsv::compareKeys(tk, key, numeric) < 0) {
+      lo = s + 1;
+    }
+    else {
+      found = s;
+      hi = mid;
+    }
+  }
+
+  return found;
+}
+
+// Invokes the callback for the tokens of every row whose key column lies in
+// [first, last] of a file sorted by that column. Only the rows in the range
+// and the rows probed on the way to them are parsed, there is no index.
+// Keys are compared as numbers when numeric is set, see compareKeys.
+// Rows are counted from zero at the first row found.
+template<typename F>
+Error& CSVReader::findSortedRange(Error& err, F& clb, uint32_t col, std::string_view first, std::string_view last, bool numeric) {
+  namespace dcsv = detail::csv;
+
+  if(!err.peekOk())
+    return err;
+
+  if(!reader.isOpen()) {
+    WK_RAISE_ERR(err, NotOpen, "CSVReader: no file open to read");
+    return err;
+  }
+
+  int64_t begin = lowerBound(err, col, first, numeric);
+  if(!err.peekOk() || begin >= reader.size(err))
+    return err;
+
+  reader.seek(err, begin, Whence::Begin);
+  row = 0;
+  column = 0;
+
+  for(const CSVRow& r : rows(err)) {
+    std::string_view tk = col < r.size() ? r[col].get<std::string_view>(err) : std::string_view();
+    if(dcsv::compareKeys(tk, last, numeric) > 0)
+      break;
+
+    for(size_t c = 0; c < r.size() && err.peekOk(); c++) {
+      CSVReader::Token t = r[c];
+      clb(err, r.getRow(), (uint32_t)c, t);
+    }
+  }
+
+  row = 0;
+  return err;
+}
+
+// Invokes the callback for the tokens of every row whose key column equals key,
+// see findSortedRange.
+template<typename F>
+Error& CSVReader::findSorted(Error& err, F& clb, uint32_t col, std::string_view key, bool numeric) {
+  return findSortedRange(err, clb, col, key, key, numeric);
+}
+
+} // namespace Wikinger
@@ -0,0 +1,172 @@
+namespace Wikinger {
+namespace detail {
+namespace csv {
+
+// Records the offsets of the rows beginning in [from, end) where from is known
+// to begin a row, and therefore to be outside of quotes.
+template<masksSig masks, tzcntSig tzcnt, andnSig andn>
+void rowStarts(Error& err, UnbufferedFileReader& file, int64_t from, int64_t end, size_t alignment, char seperator, std::vector<int64_t>& starts) {
+  uint32_t row = 0;
+  uint32_t column = 0;
+  CSV_Context ctx(row, column);
+
+  size_t size = 1024 * 1024;
+  size = (1 + (size - 1) / alignment) * alignment;
+  char* buf = (char*)getAllocator().allocate(size + 64, alignment);
+
+  int64_t pos = from - from % alignment;
+  size_t skip = (size_t)(from - pos);
+  file.seek(err, pos, Whence::Begin);
+
+  starts.push_back(from);
+
+  while(pos < end && err.peekOk()) {
+    size_t read = file.readbin(err, buf, size);
+    size_t len = (int64_t)read < end - pos ? read : (size_t)(end - pos);
+
+    // blanks neither open quotes nor end rows, the bytes before from are
+    // blanked instead of skipped so that the blocks stay aligned.
+    memset(buf, ' ', skip < read ? skip : read);
+    skip = 0;
+
+    for(size_t i = 0; i < len; i += 64) {
+      masks(ctx, buf + i, seperator);
+      uint64_t fill = quoteFill<andn>(ctx, len - i);
+      uint64_t nl = andn(fill, ctx.nl_mask);
+
+      while(nl != 0) {
+        int64_t s = pos + i + tzcnt(nl) + 1;
+        if(s < end)
+          starts.push_back(s);
+        nl &= nl - 1;
+      }
+    }
+
+    pos += read;
+    if(read < size)
+      break;
+  }
+
+  getAllocator().deallocate(buf, size + 64, alignment);
+}
+
+} // namespace csv
+} // namespace detail
+
+// Invokes the callback for the tokens of the last n rows of the file, in the
+// order of the file or last row first when reverse is set. Rows are counted
+// from zero at the first of the rows returned in either order.
+// The file is read backwards in windows which double in size until they hold
+// n rows. Each window is resynchronized to its first row the way range reads
+// are, which looks at the bytes before it to guess the quote state and then
+// verifies it forwards to the next newline, and the newlines outside quotes
+// are scanned from there up to the window before it. Only the tail of the
+// file is read no matter how large the file is.
+template<typename F>
+Error& CSVReader::tail(Error& err, F& clb, uint64_t n, bool reverse) {
+  namespace dcsv = detail::csv;
+
+  if(!err.peekOk())
+    return err;
+
+  if(!reader.isOpen()) {
+    WK_RAISE_ERR(err, NotOpen, "CSVReader: no file open to read");
+    return err;
+  }
+
+  static RuntimeDispatch<int64_t(Error&, UnbufferedFileReader&, dcsv::CSV_Chunk&, int64_t, QuoteState, char, size_t)> dispatchResync{
+    { dcsv::resyncRow<dcsv::masks_AVX2, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 },
+    { dcsv::resyncRow<dcsv::masks_SSE2, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 },
+    { dcsv::resyncRow<dcsv::masks_x64, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::bmi1 },
+    { dcsv::resyncRow<dcsv::masks_AVX2, dcsv::tzcnt_x64, dcsv::andn_x64>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { dcsv::resyncRow<dcsv::masks_SSE2, dcsv::tzcnt_x64, dcsv::andn_x64>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { dcsv::resyncRow<dcsv::masks_x64, dcsv::tzcnt_x64, dcsv::andn_x64>, 0 }
+  };
+  static RuntimeDispatch<void(Error&, UnbufferedFileReader&, int64_t, int64_t, size_t, char, std::vector<int64_t>&)> dispatchStarts{
+    { dcsv::rowStarts<dcsv::masks_AVX2, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 },
+    { dcsv::rowStarts<dcsv::masks_SSE2, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 },
+    { dcsv::rowStarts<dcsv::masks_x64, dcsv::tzcnt_bmi, dcsv::andn_bmi>, CPU::ISA::bmi1 },
+    { dcsv::rowStarts<dcsv::masks_AVX2, dcsv::tzcnt_x64, dcsv::andn_x64>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { dcsv::rowStarts<dcsv::masks_SSE2, dcsv::tzcnt_x64, dcsv::andn_x64>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { dcsv::rowStarts<dcsv::masks_x64, dcsv::tzcnt_x64, dcsv::andn_x64>, 0 }
+  };
+
+  if(n == 0)
+    return err;
+
+  int64_t fsize = reader.size(err);
+  int64_t window = 1024 * 64;
+  window = (1 + (window - 1) / req_alignment) * req_alignment;
+
+  dcsv::CSV_Chunk ck;
+  std::vector<int64_t> starts;
+  std::vector<int64_t> before;
+
+  // starts holds the rows beginning in [end, fsize).
+  int64_t end = fsize;
+  while(starts.size() < n && end > 0 && err.peekOk()) {
+    int64_t at = end - window;
+    at = at <= 0 ? 0 : at - at % (int64_t)req_alignment;
+    window *= 2;
+
+    int64_t first = dispatchResync(err, reader, ck, at, QuoteState::Unknown, seperator, req_alignment);
+    if(first >= end)
+      continue;
+
+    before.clear();
+    dispatchStarts(err, reader, first, end, req_alignment, seperator, before);
+    before.insert(before.end(), starts.begin(), starts.end());
+    starts.swap(before);
+    end = first;
+  }
+
+  if(!err.peekOk() || starts.empty())
+    return err;
+
+  size_t k = starts.size() > n ? starts.size() - (size_t)n : 0;
+  reader.seek(err, starts[k], Whence::Begin);
+  row = 0;
+  column = 0;
+
+  if(!reverse) {
+    for(const CSVRow& r : rows(err)) {
+      for(size_t c = 0; c < r.size() && err.peekOk(); c++) {
+        CSVReader::Token tk = r[c];
+        clb(err, r.getRow(), (uint32_t)c, tk);
+      }
+    }
+
+    row = 0;
+    return err;
+  }
+
+  // the rows are only valid while they are iterated, so they are copied to
+  // be handed out once the last one is known.
+  std::string text;
+  std::vector<size_t> tokens;
+  std::vector<size_t> firsts;
+
+  for(const CSVRow& r : rows(err)) {
+    firsts.push_back(tokens.size());
+    for(size_t c = 0; c < r.size(); c++) {
+      std::string_view tk = r[c].get<std::string_view>(err);
+      text.append(tk.data(), tk.size());
+      tokens.push_back(text.size());
+    }
+  }
+  firsts.push_back(tokens.size());
+
+  for(size_t i = firsts.size() - 1; i > 0 && err.peekOk(); i--) {
+    size_t b = firsts[i - 1];
+    for(size_t t = b; t < firsts[i] && err.peekOk(); t++) {
+      size_t from = t == 0 ? 0 : tokens[t - 1];
+      CSVReader::Token tk(std::string_view(text.data() + from, tokens[t] - from));
+      clb(err, (uint32_t)(firsts.size() - 1 - i), (uint32_t)(t - b), tk);
+    }
+  }
+
+  row = 0;
+  return err;
+}
+
+} // namespace Wikinger
@@ -0,0 +1,199 @@
+#include <vector>
+
+namespace Wikinger {
+namespace detail {
+namespace csv {
+
+// Returns the bytes of the block which unescaping removes, these are the
+// backslashes escaping a character and the first quote of every pair of quotes.
+// more tells whether the token goes on after the block and next_quote whether
+// it goes on with a quote.
+template<masksSig masks>
+WK_FORCE_INLINE uint64_t removedBytes(CSV_Context& ctx, const char* p, size_t len, uint64_t& esc_carry, uint64_t& quote_carry, bool more, bool next_quote) {
+  masks(ctx, p, ',');
+  uint64_t valid = len >= 64 ? 0xffffffffffffffff : WK_BIT(len) - 1;
+  uint64_t bs = ctx.esc_mask & valid;
+  uint64_t quotes = ctx.quote_mask & valid;
+
+  uint64_t escaped = findEscaped(bs, esc_carry) & valid;
+  uint64_t escapers = (escaped >> 1) | (more ? esc_carry << 63 : 0);
+
+  // a quote escapes the quote after it the same way, escaped quotes do not pair.
+  quotes = andn_x64(escaped, quotes);
+  uint64_t paired = findEscaped(quotes, quote_carry) & valid;
+  uint64_t pairs = ((paired >> 1) | (quote_carry << 63)) & ((quotes >> 1) | ((uint64_t)next_quote << 63));
+
+  return escapers | pairs;
+}
+
+// Packs the kept bytes of 64 bytes at in to out and returns how many there were.
+WK_FORCE_INLINE size_t compact_x64(const char* in, uint64_t keep, char* out) {
+  size_t n = 0;
+  for(; keep != 0; keep &= keep - 1) {
+    out[n++] = in[tzcnt_x64(keep)];
+  }
+  return n;
+}
+
+// The same using the BMI2 pext instruction eight bytes at a time, each bit of
+// the keep mask is widened into a byte of the pext mask with pdep.
+// Up to 8 bytes past the returned length may be written.
+WK_FORCE_INLINE size_t compact_bmi2(const char* in, uint64_t keep, char* out) {
+  size_t n = 0;
+  for(int k = 0; k < 8; k++) {
+    uint64_t bits = (keep >> (k * 8)) & 0xff;
+    uint64_t word;
+    memcpy(&word, in + k * 8, 8);
+
+    uint64_t sel = _pdep_u64(bits, 0x0101010101010101) * 0xff;
+    word = _pext_u64(word, sel);
+    memcpy(out + n, &word, 8);
+    n += _mm_popcnt_u64(bits);
+  }
+  return n;
+}
+
+// The same using the AVX-512 VBMI2 vpcompressb instruction on the whole block.
+// Up to 64 bytes past the returned length may be written.
+WK_FORCE_INLINE size_t compact_vbmi2(const char* in, uint64_t keep, char* out) {
+  __m512i v = _mm512_loadu_si512((const void*)in);
+  _mm512_storeu_si512((void*)out, _mm512_maskz_compress_epi8(keep, v));
+  return _mm_popcnt_u64(keep);
+}
+
+typedef size_t(compactSig)(const char*, uint64_t, char*);
+
+// Writes the unescaped token to out, which has room for the token and 64
+// bytes more, and returns its length. The last partial block is copied out
+// first so nothing past the token is read.
+template<masksSig masks, compactSig compact>
+size_t unescapeToken(const char* p, size_t len, char* out) {
+  uint32_t row = 0;
+  uint32_t column = 0;
+  CSV_Context ctx(row, column);
+
+  uint64_t esc_carry = 0;
+  uint64_t quote_carry = 0;
+  size_t n = 0;
+
+  alignas(64) char tail[64];
+  for(size_t i = 0; i < len; i += 64) {
+    const char* block = p + i;
+    size_t rest = len - i;
+    if(rest < 64) {
+      memcpy(tail, block, rest);
+      memset(tail + rest, 0, 64 - rest);
+      block = tail;
+    }
+
+    bool more = rest > 64;
+    uint64_t removed = removedBytes<masks>(ctx, block, rest, esc_carry, quote_carry, more, more && p[i + 64] == '"');
+    uint64_t keep = andn_x64(removed, rest >= 64 ? 0xffffffffffffffff : WK_BIT(rest) - 1);
+
+    n += compact(block, keep, out + n);
+  }
+  return n;
+}
+
+typedef size_t(unescapeSig)(const char*, size_t, char*);
+
+} // namespace csv
+} // namespace detail
+
+// Removes the escapes from tokens, the backslash escaping a character is
+// dropped and a pair of quotes is collapsed into one. Tokens without either
+// are returned as they are, the others are unescaped into an arena which is
+// kept until clear is called.
+// The kept bytes of every 64 byte block are packed with pext or vpcompressb
+// where the cpu has them, see detail::csv::unescapeToken.
+class CSVUnescaper {
+public:
+  CSVUnescaper();
+  CSVUnescaper(const CSVUnescaper&) = delete;
+  ~CSVUnescaper();
+
+  std::string_view unescape(std::string_view tk);
+  void clear();
+
+private:
+  struct Block {
+    char* mem;
+    size_t size;
+  };
+
+  detail::csv::unescapeSig* impl;
+
+  std::vector<Block> blocks;
+  size_t used;
+  size_t cap;
+};
+
+CSVUnescaper::CSVUnescaper() : used(0), cap(0) {
+  namespace dcsv = detail::csv;
+
+  static RuntimeDispatch<dcsv::unescapeSig> dispatch{
+    { dcsv::unescapeToken<dcsv::masks_AVX2, dcsv::compact_vbmi2>, CPU::ISA::avx512_vbmi2 | CPU::ISA::avx512_f | CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::popcnt },
+    { dcsv::unescapeToken<dcsv::masks_AVX2, dcsv::compact_bmi2>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi2 | CPU::ISA::popcnt },
+    { dcsv::unescapeToken<dcsv::masks_SSE2, dcsv::compact_bmi2>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi2 | CPU::ISA::popcnt },
+    { dcsv::unescapeToken<dcsv::masks_AVX2, dcsv::compact_x64>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { dcsv::unescapeToken<dcsv::masks_SSE2, dcsv::compact_x64>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { dcsv::unescapeToken<dcsv::masks_x64, dcsv::compact_x64>, 0 }
+  };
+  impl = dispatch.get();
+}
+
+CSVUnescaper::~CSVUnescaper() {
+  for(Block& b : blocks)
+    getAllocator().deallocate(b.mem, b.size, 64);
+}
+
+std::string_view CSVUnescaper::unescape(std::string_view tk) {
+  if(tk.find_first_of("\\\"") == std::string_view::npos)
+    return tk;
+
+  size_t need = tk.size() + 64;
+  if(blocks.empty() || cap - used < need) {
+    size_t sz = need > 1024 * 64 ? need : 1024 * 64;
+    blocks.push_back({ (char*)getAllocator().allocate(sz, 64), sz });
+    used = 0;
+    cap = sz;
+  }
+
+  char* out = blocks.back().mem + used;
+  size_t n = impl(tk.data(), tk.size(), out);
+  used += n;
+  return std::string_view(out, n);
+}
+
+// Releases everything unescaped so far, only the last block is kept for reuse.
+void CSVUnescaper::clear() {
+  if(blocks.size() > 1) {
+    Block last = blocks.back();
+    blocks.pop_back();
+    for(Block& b : blocks)
+      getAllocator().deallocate(b.mem, b.size, 64);
+    blocks.clear();
+    blocks.push_back(last);
+  }
+  used = 0;
+}
+
+// Unescapes every token before handing it to the callback, for use with any
+// of the reads. The arena is cleared after every token.
+template<typename F>
+class CSVUnescaping {
+public:
+  CSVUnescaping(F& f) : clb(f) {}
+
+  void operator()(Error& err, uint32_t row, uint32_t col, CSVReader::Token& tk) {
+    CSVReader::Token un(esc.unescape(tk.get<std::string_view>(err)));
+    clb(err, row, col, un);
+    esc.clear();
+  }
+
+private:
+  F& clb;
+  CSVUnescaper esc;
+};
+
+} // namespace Wikinger
@@ -0,0 +1,117 @@
+namespace Wikinger {
+namespace detail {
+namespace csv {
+
+// Finds the byte range of the rows [skip, skip + limit) counted from the row
+// beginning at from, a limit of 0 reaches to the end of the file. Returns the
+// amount of rows skipped, less than skip when the file ends before.
+// Whole blocks are skipped with a popcount of their newlines and the newline
+// ending the last skipped row is located with a select. Nothing past the end
+// of the range is read.
+template<masksSig masks, andnSig andn, popcntSig popcnt, selectSig select>
+uint64_t findWindow(Error& err, UnbufferedFileReader& file, size_t alignment, char seperator, int64_t from, uint64_t skip, uint64_t limit, int64_t& begin, int64_t& end) {
+  uint32_t row = 0;
+  uint32_t column = 0;
+  CSV_Context ctx(row, column);
+
+  begin = from;
+  end = -1;
+  if(skip == 0 && limit == 0)
+    return 0;
+
+  size_t size = 1024 * 1024;
+  size = (1 + (size - 1) / alignment) * alignment;
+  char* buf = (char*)getAllocator().allocate(size + 64, alignment);
+
+  int64_t pos = from - from % alignment;
+  size_t lead = (size_t)(from - pos);
+  file.seek(err, pos, Whence::Begin);
+
+  // the newlines counted so far and how many of them end the range.
+  uint64_t n = 0;
+  uint64_t last = limit == 0 ? 0 : skip + limit;
+  bool found = skip == 0;
+  bool done = false;
+
+  size_t read;
+  do {
+    read = file.readbin(err, buf, size);
+
+    // from begins a row so the bytes before it cannot be inside quotes,
+    // they are blanked to keep the blocks aligned.
+    memset(buf, ' ', lead < read ? lead : read);
+    lead = 0;
+
+    for(size_t i = 0; i < read && !done; i += 64) {
+      masks(ctx, buf + i, seperator);
+      uint64_t fill = quoteFill<andn>(ctx, read - i);
+      uint64_t nl = andn(fill, ctx.nl_mask);
+      uint64_t cnt = popcnt(nl);
+
+      if(!found && n + cnt >= skip) {
+        begin = pos + i + select(nl, skip - n - 1) + 1;
+        found = true;
+        done = last == 0;
+      }
+      if(found && last != 0 && n + cnt >= last) {
+        end = pos + i + select(nl, last - n - 1) + 1;
+        done = true;
+      }
+
+      n += cnt;
+    }
+
+    pos += read;
+  } while(read == size && !done && err.peekOk());
+
+  getAllocator().deallocate(buf, size + 64, alignment);
+
+  if(!found) {
+    begin = pos;
+    return n;
+  }
+  return skip;
+}
+
+} // namespace csv
+} // namespace detail
+
+// Reads with skipped rows or a limit, see setSkipRows and setLimit.
+// The rows in the window are found with the mask stage before the window
+// is parsed as a range, rows keep the numbers they would have had.
+template<typename F>
+Error& CSVReader::readWindow(Error& err, F& clb) {
+  namespace dcsv = detail::csv;
+
+  static RuntimeDispatch<uint64_t(Error&, UnbufferedFileReader&, size_t, char, int64_t, uint64_t, uint64_t, int64_t&, int64_t&)> dispatchWindow{
+    { dcsv::findWindow<dcsv::masks_AVX2, dcsv::andn_bmi, dcsv::popcnt_abm, dcsv::select_bmi2>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 | CPU::ISA::bmi2 | CPU::ISA::popcnt },
+    { dcsv::findWindow<dcsv::masks_SSE2, dcsv::andn_bmi, dcsv::popcnt_abm, dcsv::select_bmi2>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 | CPU::ISA::bmi2 | CPU::ISA::popcnt },
+    { dcsv::findWindow<dcsv::masks_x64, dcsv::andn_bmi, dcsv::popcnt_abm, dcsv::select_bmi2>, CPU::ISA::bmi1 | CPU::ISA::bmi2 | CPU::ISA::popcnt },
+    { dcsv::findWindow<dcsv::masks_AVX2, dcsv::andn_x64, dcsv::popcnt_x64, dcsv::select_x64>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { dcsv::findWindow<dcsv::masks_SSE2, dcsv::andn_x64, dcsv::popcnt_x64, dcsv::select_x64>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { dcsv::findWindow<dcsv::masks_x64, dcsv::andn_x64, dcsv::popcnt_x64, dcsv::select_x64>, 0 }
+  };
+  static RuntimeDispatch<Error&(Error&, F&, uint32_t&, uint32_t&, char, dcsv::CSVFileReader&)> dispatch{
+    { dcsv::readCSV_AVX2<false, dcsv::tzcnt_bmi, dcsv::andn_bmi, F>, CPU::ISA::avx2 | CPU::ISA::avx | CPU::ISA::bmi1 },
+    { dcsv::readCSV_SSE2<false, dcsv::tzcnt_bmi, dcsv::andn_bmi, F>, CPU::ISA::sse2 | CPU::ISA::sse | CPU::ISA::bmi1 },
+    { dcsv::readCSV_bmi1<false, dcsv::tzcnt_bmi, dcsv::andn_bmi, F>, CPU::ISA::bmi1 },
+    { dcsv::readCSV_AVX2<false, dcsv::tzcnt_x64, dcsv::andn_x64, F>, CPU::ISA::avx2 | CPU::ISA::avx },
+    { dcsv::readCSV_SSE2<false, dcsv::tzcnt_x64, dcsv::andn_x64, F>, CPU::ISA::sse2 | CPU::ISA::sse },
+    { dcsv::readCSV_bmi1<false, dcsv::tzcnt_x64, dcsv::andn_x64, F>, 0 }
+  };
+
+  int64_t begin;
+  int64_t end;
+  uint64_t skipped = dispatchWindow(err, reader, req_alignment, seperator, reader.tell(), skip_rows, row_limit, begin, end);
+  row += (uint32_t)skipped;
+  column = 0;
+
+  if(!err.peekOk() || skipped < skip_rows || (end >= 0 && begin >= end))
+    return err;
+
+  dcsv::CSVFileReader cread(reader, req_alignment);
+  cread.setRange(err, begin, end);
+  return dispatch(err, clb, row, column, seperator, cread);
+}
+
+} // namespace Wikinger
@@ -0,0 +1,415 @@
+#include <cstdlib>
+
+namespace Wikinger {
+
+// Summaries of fixed size blocks of rows used to skip whole blocks in scans
+// that filter on a column. For every block and column there is the minimum and
+// maximum of the values which are numbers, and a Bloom filter of all values.
+// A block is only read when the summary of the column admits the predicate,
+// a scan for a value which is in a handful of rows therefore reads a handful
+// of blocks. Like the key index it is filled by adding the rows of a pass
+// over the file and is meant for files which do not change, it is stamped
+// with the file it was built from.
+// The sidecar is the header followed by the blocks, the zones and the filters.
+class CSVZoneMap {
+public:
+  CSVZoneMap(uint32_t block_rows = 64 * 1024, uint32_t bloom_bits = 8);
+
+  void add(const CSVRow& row);
+  void finish(const Fileinfo& info);
+
+  Error& save(Error& err, const Filepath& file) const;
+  Error& load(Error& err, const Filepath& file);
+
+  bool matches(const Fileinfo& info) const;
+
+  // Returns whether the block might have a row whose column is a number in
+  // [lo, hi] or is equal to key respectively.
+  bool mayContain(size_t block, uint32_t col, double lo, double hi) const;
+  bool mayContain(size_t block, uint32_t col, std::string_view key) const;
+
+  static Filepath getSidecar(const Filepath& csv);
+
+  uint32_t getBlockRows() const { return block_rows; }
+  size_t getBlockCount() const { return blocks.size(); }
+
+private:
+  friend class CSVReader;
+
+  struct Block {
+    int64_t begin;
+    int64_t end;
+    uint64_t first;
+    uint64_t rows;
+    uint64_t zone;
+    uint64_t columns;
+  };
+
+  struct Zone {
+    double min;
+    double max;
+    uint64_t numbers;
+  };
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_rows;
+    uint32_t bloom_bits;
+    uint32_t words;
+    uint64_t size;
+    uint64_t mtime;
+    uint64_t blocks;
+    uint64_t zones;
+  };
+
+  uint32_t block_rows;
+  uint32_t bloom_bits;
+  // The size of a single filter in 64 bit words, zero without filters.
+  uint32_t words;
+  uint64_t size;
+  uint64_t mtime;
+
+  std::vector<Block, StdAllocator<Block>> blocks;
+  std::vector<Zone, StdAllocator<Zone>> zones;
+  std::vector<uint64_t, StdAllocator<uint64_t>> blooms;
+};
+
+namespace detail {
+namespace csv {
+
+constexpr char CSV_ZoneMagic[8] = { 'W', 'K', 'C', 'S', 'V', 'Z', 'O', 'N' };
+constexpr uint32_t CSV_ZoneVersion = 1;
+constexpr uint32_t CSV_BloomHashes = 3;
+
+// Parses the whole token as a number, tokens which merely begin with one are not.
+inline bool parseNumber(std::string_view tk, double& value) {
+  char tmp[64];
+  if(tk.empty() || tk.size() >= sizeof(tmp))
+    return false;
+
+  char c = tk[0];
+  if(!((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.'))
+    return false;
+
+  memcpy(tmp, tk.data(), tk.size());
+  tmp[tk.size()] = '\0';
+
+  char* endptr = nullptr;
+  value = strtod(tmp, &endptr);
+  return endptr == tmp + tk.size();
+}
+
+// The bits of a key in a filter of words 64 bit words, derived from one hash
+// by double hashing.
+template<typename F>
+void bloomBits(uint64_t hash, uint32_t words, F f) {
+  uint64_t bits = (uint64_t)words * 64;
+  uint64_t h1 = hash;
+  uint64_t h2 = (hash >> 32) | 1;
+
+  for(uint32_t k = 0; k < CSV_BloomHashes; k++) {
+    f((h1 + k * h2) % bits);
+  }
+}
+
+} // namespace csv
+} // namespace detail
+
+CSVZoneMap::CSVZoneMap(uint32_t _block_rows, uint32_t _bloom_bits) :
+  block_rows(_block_rows == 0 ? 1 : _block_rows), bloom_bits(_bloom_bits), words(0), size(0), mtime(0) {
+  words = (uint32_t)(((uint64_t)block_rows * bloom_bits + 63) / 64);
+}
+
+void CSVZoneMap::add(const CSVRow& row) {
+  namespace dcsv = detail::csv;
+
+  if(blocks.empty() || blocks.back().rows == block_rows) {
+    if(!blocks.empty())
+      blocks.back().end = row.getOffset();
+    blocks.push_back(Block{ row.getOffset(), row.getOffset(), row.getRow(), 0, zones.size(), 0 });
+  }
+
+  Block& b = blocks.back();
+  b.rows++;
+
+  // the zones of a block are the last ones, the block grows with the widest row.
+  if(row.size() > b.columns) {
+    size_t n = b.zone + row.size();
+    zones.resize(n, Zone{ 0.0, 0.0, 0 });
+    blooms.resize(n * words, 0);
+    b.columns = row.size();
+  }
+
+  Error err;
+  for(size_t c = 0; c < row.size(); c++) {
+    std::string_view tk = row[c].get<std::string_view>(err);
+    Zone& z = zones[b.zone + c];
+
+    double v;
+    if(dcsv::parseNumber(tk, v)) {
+      z.min = z.numbers == 0 || v < z.min ? v : z.min;
+      z.max = z.numbers == 0 || v > z.max ? v : z.max;
+      z.numbers++;
+    }
+
+    if(words != 0) {
+      uint64_t* bloom = blooms.data() + (b.zone + c) * words;
+      dcsv::bloomBits(CSVKeyIndex::hash(tk), words, [bloom](uint64_t bit) {
+        bloom[bit / 64] |= 1ull << (bit % 64);
+      });
+    }
+  }
+}
+
+void CSVZoneMap::finish(const Fileinfo& info) {
+  if(!blocks.empty())
+    blocks.back().end = info.size;
+  size = info.size;
+  mtime = info.mtime;
+}
+
+bool CSVZoneMap::matches(const Fileinfo& info) const {
+  return info.size == size && info.mtime == mtime;
+}
+
+bool CSVZoneMap::mayContain(size_t block, uint32_t col, double lo, double hi) const {
+  const Block& b = blocks[block];
+  if(col >= b.columns)
+    return false;
+
+  const Zone& z = zones[b.zone + col];
+  return z.numbers != 0 && z.min <= hi && z.max >= lo;
+}
+
+bool CSVZoneMap::mayContain(size_t block, uint32_t col, std::string_view key) const {
+  const Block& b = blocks[block];
+  if(col >= b.columns)
+    return false;
+  if(words == 0)
+    return true;
+
+  const uint64_t* bloom = blooms.data() + (b.zone + col) * words;
+  bool found = true;
+  detail::csv::bloomBits(CSVKeyIndex::hash(key), words, [bloom, &found](uint64_t bit) {
+    found = found && (bloom[bit / 64] >> (bit % 64)) & 1;
+  });
+  return found;
+}
+
+Filepath CSVZoneMap::getSidecar(const Filepath& csv) {
+  std::string p = csv;
+  p += ".zone";
+  return Filepath(std::string_view(p));
+}
+
+Error& CSVZoneMap::save(Error& err, const Filepath& file) const {
+  if(!err.peekOk())
+    return err;
+
+  FILE* f = detail::csv::openSidecar(file, "wb");
+  if(f == nullptr) {
+    WK_RAISE_ERR(err, CannotOpen, "CSVZoneMap: Couldn't create '{}'", file);
+    return err;
+  }
+
+  Header h;
+  memcpy(h.magic, detail::csv::CSV_ZoneMagic, sizeof(h.magic));
+  h.version = detail::csv::CSV_ZoneVersion;
+  h.block_rows = block_rows;
+  h.bloom_bits = bloom_bits;
+  h.words = words;
+  h.size = size;
+  h.mtime = mtime;
+  h.blocks = blocks.size();
+  h.zones = zones.size();
+
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  ok = ok && fwrite(blocks.data(), sizeof(Block), blocks.size(), f) == blocks.size();
+  ok = ok && fwrite(zones.data(), sizeof(Zone), zones.size(), f) == zones.size();
+  ok = ok && fwrite(blooms.data(), sizeof(uint64_t), blooms.size(), f) == blooms.size();
+  ok = fclose(f) == 0 && ok;
+
+  if(!ok)
+    WK_RAISE_ERR(err, ReaderWriter_Write, "CSVZoneMap: Couldn't write '{}'", file);
+  return err;
+}
+
+Error& CSVZoneMap::load(Error& err, const Filepath& file) {
+  if(!err.peekOk())
+    return err;
+
+  FILE* f = detail::csv::openSidecar(file, "rb");
+  if(f == nullptr) {
+    WK_RAISE_ERR(err, CannotOpen, "CSVZoneMap: Couldn't open '{}'", file);
+    return err;
+  }
+
+  Header h;
+  bool ok = fread(&h, sizeof(h), 1, f) == 1;
+  ok = ok && memcmp(h.magic, detail::csv::CSV_ZoneMagic, sizeof(h.magic)) == 0;
+  ok = ok && h.version == detail::csv::CSV_ZoneVersion;
+
+  if(ok) {
+    blocks.resize(h.blocks);
+    zones.resize(h.zones);
+    blooms.resize(h.zones * h.words);
+    ok = fread(blocks.data(), sizeof(Block), blocks.size(), f) == blocks.size();
+    ok = ok && fread(zones.data(), sizeof(Zone), zones.size(), f) == zones.size();
+    ok = ok && fread(blooms.data(), sizeof(uint64_t), blooms.size(), f) == blooms.size();
+  }
+  fclose(f);
+
+  if(!ok) {
+    blocks.clear();
+    zones.clear();
+    blooms.clear();
+    WK_RAISE_ERR(err, InvalidFormat, "CSVZoneMap: '{}' is not a zone map", file);
+    return err;
+  }
+
+  block_rows = h.block_rows;
+  bloom_bits = h.bloom_bits;
+  words = h.words;
+  size = h.size;
+  mtime = h.mtime;
+  return err;
+}
+
+// Builds the zone map in a pass of its own, the file is left at its beginning.
+Error& CSVReader::buildZoneMap(Error& err, CSVZoneMap& zones) {
+  if(!err.peekOk())
+    return err;
+
+  reader.seek(err, 0, Whence::Begin);
+  row = 0;
+  column = 0;
+
+  zones.blocks.clear();
+  zones.zones.clear();
+  zones.blooms.clear();
+  for(const CSVRow& r : rows(err)) {
+    zones.add(r);
+  }
+
+  Fileinfo info;
+  stat(info, path);
+  zones.finish(info);
+
+  reader.seek(err, 0, Whence::Begin);
+  row = 0;
+  return err;
+}
+
+// Loads the sidecar zone map of the open file, or builds and saves it when
+// there is none, it is out of date or was built with other block sizes.
+Error& CSVReader::loadZoneMap(Error& err, CSVZoneMap& zones) {
+  if(!err.peekOk())
+    return err;
+
+  Filepath sidecar = CSVZoneMap::getSidecar(path);
+  Fileinfo info;
+  stat(info, path);
+
+  CSVZoneMap loaded;
+  Error lerr;
+  loaded.load(lerr, sidecar);
+  if(lerr.isOk() && loaded.matches(info) && loaded.block_rows == zones.block_rows && loaded.bloom_bits == zones.bloom_bits) {
+    zones = std::move(loaded);
+    return err;
+  }
+
+  buildZoneMap(err, zones);
+
+  Error serr;
+  zones.save(serr, sidecar);
+  if(!serr.isOk())
+    WK_DEBUG("CSVReader: Couldn't save the zone map of '{}'", path);
+
+  return err;
+}
+
+// Parses the blocks the zone map cannot rule out and invokes the callback for
+// the tokens of the rows passing the filter. Runs of adjacent blocks are read
+// in one go, the blocks in between are seeked over without being read.
+template<typename F, typename B, typename R>
+Error& CSVReader::scanZones(Error& err, F& clb, const CSVZoneMap& zones, B& block, R& keep) {
+  if(!err.peekOk())
+    return err;
+
+  if(!reader.isOpen()) {
+    WK_RAISE_ERR(err, NotOpen, "CSVReader: no file open to read");
+    return err;
+  }
+
+  // a rewrite of the same size moves the rows as well, the mtime is compared too.
+  Fileinfo info;
+  stat(info, path);
+  if(!zones.matches(info)) {
+    WK_RAISE_ERR(err, InvalidFormat, "CSVReader: the zone map does not belong to '{}'", path);
+    return err;
+  }
+
+  size_t n = zones.blocks.size();
+  for(size_t k = 0; k < n && err.peekOk(); k++) {
+    if(!block(k))
+      continue;
+
+    size_t last = k;
+    while(last + 1 < n && block(last + 1)) {
+      last++;
+    }
+
+    int64_t end = zones.blocks[last].end;
+    reader.seek(err, zones.blocks[k].begin, Whence::Begin);
+    row = (uint32_t)zones.blocks[k].first;
+    column = 0;
+
+    for(const CSVRow& r : rows(err)) {
+      if(r.getOffset() >= end)
+        break;
+      if(!keep(r))
+        continue;
+
+      for(size_t col = 0; col < r.size() && err.peekOk(); col++) {
+        CSVReader::Token tk = r[col];
+        clb(err, r.getRow(), (uint32_t)col, tk);
+      }
+    }
+
+    k = last;
+  }
+
+  row = 0;
+  column = 0;
+  return err;
+}
+
+// Invokes the callback for the tokens of every row whose column is a number in [lo, hi].
+template<typename F>
+Error& CSVReader::scanRange(Error& err, F& clb, const CSVZoneMap& zones, uint32_t col, double lo, double hi) {
+  auto block = [&zones, col, lo, hi](size_t k) {
+    return zones.mayContain(k, col, lo, hi);
+  };
+  auto keep = [col, lo, hi](const CSVRow& r) {
+    Error err;
+    double v;
+    return col < r.size() && detail::csv::parseNumber(r[col].get<std::string_view>(err), v) && v >= lo && v <= hi;
+  };
+  return scanZones(err, clb, zones, block, keep);
+}
+
+// Invokes the callback for the tokens of every row whose column equals key.
+template<typename F>
+Error& CSVReader::scanEqual(Error& err, F& clb, const CSVZoneMap& zones, uint32_t col, std::string_view key) {
+  auto block = [&zones, col, key](size_t k) {
+    return zones.mayContain(k, col, key);
+  };
+  auto keep = [col, key](const CSVRow& r) {
+    Error err;
+    return col < r.size() && r[col].get<std::string_view>(err) == key;
+  };
+  return scanZones(err, clb, zones, block, keep);
+}
+
+} // namespace Wikinger
@@ -1,6 +1,7 @@
 #include "../Platform.h"
 #include "FileReader.h"
 #include "../Error.h"
+#include "../Allocator.h"
 
 #if WK_PLATFORM_WINDOWS || WK_PLATFORM_XBOXONE || WK_PLATFORM_WINRT
 #include <Windows.h>
@@ -28,8 +29,9 @@ Error& UnbufferedFileReader::open(Error& err, const Filepath& path) {
     return err;
   }
   else {
-    hnd = CreateFileA(path.getPtr(), GENERIC_READ, FILE_SHARE_READ, nullptr,
-                      OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
+    // other processes may keep appending to, or rotate, the file while it is read.
+    hnd = CreateFileA(path.getPtr(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                      nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
 
     if(hnd == INVALID_HANDLE_VALUE) {
       WK_RAISE_ERR(err, CannotOpen, "FileReader: Couldn't open file '{}'", path);
@@ -139,6 +141,15 @@ int64_t UnbufferedFileReader::tell() const {
   }
 }
 
+// Identifies the file itself rather than its path, a path which no longer
+// leads to the open file has had the file replaced.
+uint64_t UnbufferedFileReader::getFileId() const {
+  BY_HANDLE_FILE_INFORMATION info;
+  if(!GetFileInformationByHandle(hnd, &info))
+    return 0;
+  return (uint64_t)info.nFileIndexHigh << 32 | info.nFileIndexLow;
+}
+
 bool UnbufferedFileReader::eof() const {
   return meof;
 }
@@ -172,7 +183,7 @@ void FileReader::close() {
   UnbufferedFileReader::close();
 
   if(cache != nullptr) {
-    _aligned_free(cache);
+    getAllocator().deallocate(cache, cacheSize, cacheAlign);
     cache = nullptr;
     cacheSize = 0;
     cacheAlign = 0;
@@ -291,7 +302,7 @@ void FileReader::createCache(const Filepath& path) {
   size += alignment / 2;
   size = size - size % alignment;
 
-  cache = (char*)_aligned_malloc(size, alignment);
+  cache = (char*)getAllocator().allocate(size, alignment);
   cacheSize = size;
   cacheAlign = alignment;
   curr = cache;
@@ -23,6 +23,7 @@ public:
   size_t getAlignment(const Filepath& path) const;
   int64_t size(Error& err) const;
   int64_t tell() const;
+  uint64_t getFileId() const;
 
 private:
   void* hnd;
@@ -0,0 +1,123 @@
+#include "../Platform.h"
+#include "FileWatch.h"
+
+#include <chrono>
+#include <thread>
+
+#if WK_PLATFORM_WINDOWS || WK_PLATFORM_XBOXONE || WK_PLATFORM_WINRT
+#include <Windows.h>
+#endif
+
+#if WK_PLATFORM_LINUX
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace Wikinger {
+
+FileWatch::FileWatch() :
+#if WK_PLATFORM_WINDOWS || WK_PLATFORM_XBOXONE || WK_PLATFORM_WINRT
+  hnd(INVALID_HANDLE_VALUE),
+#else
+  hnd(nullptr),
+#endif
+  fd(-1), wd(-1) {}
+
+FileWatch::~FileWatch() {
+  close();
+}
+
+Error& FileWatch::open(Error& err, const Filepath& path) {
+  if(!err.peekOk())
+    return err;
+
+  close();
+
+  // a path without any directory is relative to the current one.
+  Filepath dir = path.getPath() == path.getString() ? Filepath(Filepath::Dir::Current) : Filepath(path.getPath());
+
+#if WK_PLATFORM_WINDOWS || WK_PLATFORM_XBOXONE || WK_PLATFORM_WINRT
+  hnd = FindFirstChangeNotificationA(dir.getPtr(), FALSE,
+                                     FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE |
+                                     FILE_NOTIFY_CHANGE_LAST_WRITE);
+
+  if(hnd == INVALID_HANDLE_VALUE)
+    WK_RAISE_ERR(err, CannotOpen, "FileWatch: Couldn't watch directory '{}'", dir);
+
+#elif WK_PLATFORM_LINUX
+  fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if(fd >= 0) {
+    wd = inotify_add_watch(fd, dir.getPtr(), IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE |
+                                             IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+  }
+
+  if(wd < 0) {
+    close();
+    WK_RAISE_ERR(err, CannotOpen, "FileWatch: Couldn't watch directory '{}'", dir);
+  }
+
+#else
+  WK_RAISE_ERR(err, NotSupported, "FileWatch: no file notifications on this platform");
+
+#endif
+  return err;
+}
+
+void FileWatch::close() {
+#if WK_PLATFORM_WINDOWS || WK_PLATFORM_XBOXONE || WK_PLATFORM_WINRT
+  if(hnd != INVALID_HANDLE_VALUE) {
+    FindCloseChangeNotification(hnd);
+    hnd = INVALID_HANDLE_VALUE;
+  }
+#elif WK_PLATFORM_LINUX
+  if(fd >= 0) {
+    ::close(fd);
+    fd = -1;
+    wd = -1;
+  }
+#endif
+}
+
+bool FileWatch::isOpen() const {
+#if WK_PLATFORM_WINDOWS || WK_PLATFORM_XBOXONE || WK_PLATFORM_WINRT
+  return hnd != INVALID_HANDLE_VALUE;
+#else
+  return fd >= 0;
+#endif
+}
+
+bool FileWatch::wait(uint32_t timeout_ms) {
+  if(!isOpen()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+    return false;
+  }
+
+#if WK_PLATFORM_WINDOWS || WK_PLATFORM_XBOXONE || WK_PLATFORM_WINRT
+  if(WaitForSingleObject(hnd, timeout_ms) != WAIT_OBJECT_0)
+    return false;
+
+  FindNextChangeNotification(hnd);
+  return true;
+
+#elif WK_PLATFORM_LINUX
+  pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  if(::poll(&pfd, 1, (int)timeout_ms) <= 0)
+    return false;
+
+  // the events themselves are of no interest, only that there were any.
+  alignas(inotify_event) char buf[4096];
+  while(::read(fd, buf, sizeof(buf)) > 0) {}
+  return true;
+
+#else
+  return false;
+
+#endif
+}
+
+}
@@ -0,0 +1,35 @@
+#ifndef WK_FILEWATCH_H
+#define WK_FILEWATCH_H
+
+#include "Filepath.h"
+#include "../Error.h"
+
+namespace Wikinger {
+
+// Waits for changes to a file, appends, truncation and the file being replaced
+// included. The directory of the file is watched since a rotated file is
+// replaced by a new one of the same name.
+// Where the platform offers no notifications, or they could not be set up,
+// wait simply sleeps for the timeout and the caller ends up polling.
+class FileWatch {
+public:
+  FileWatch();
+  ~FileWatch();
+
+  Error& open(Error& err, const Filepath& path);
+  void close();
+  bool isOpen() const;
+
+  // Returns true if a change was signaled within timeout_ms milliseconds,
+  // spurious wake ups are possible and the caller must check for itself.
+  bool wait(uint32_t timeout_ms);
+
+private:
+  void* hnd;
+  int fd;
+  int wd;
+};
+
+}
+
+#endif// WK_FILEWATCH_H
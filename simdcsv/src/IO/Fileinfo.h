@@ -13,9 +13,13 @@ enum class Filetype : uint8_t {
 struct Fileinfo {
   Filepath  filePath;
   uint64_t  size = 0;
+  uint64_t  mtime = 0;
   Filetype  type = Filetype::Count;
 };
 
+// Fills in the info of the file or directory at filePath, returns false if there is none.
+bool stat(Fileinfo& outFileInfo, const Filepath& filePath);
+
 }
 
 #endif// FILEINFO_H
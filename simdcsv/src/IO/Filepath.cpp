@@ -34,6 +34,7 @@ bool stat(Fileinfo& outFileInfo, const Filepath& filePath) {
   return false;
 #else
   outFileInfo.size = 0;
+  outFileInfo.mtime = 0;
   outFileInfo.type = Filetype::Count;
 # if WK_COMPILER_MSVC
   struct ::_stat64 st;
@@ -62,6 +63,7 @@ bool stat(Fileinfo& outFileInfo, const Filepath& filePath) {
 # endif// WK_COMPILER_MSVC
 
   outFileInfo.size = st.st_size;
+  outFileInfo.mtime = st.st_mtime;
   return true;
 
 #endif// WK_CRT_NONE
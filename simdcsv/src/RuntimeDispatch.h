@@ -41,10 +41,14 @@ public:
   }
 
   template<typename... Args>
-  auto& operator()(Args&&... args) const {
+  decltype(auto) operator()(Args&&... args) const {
     return active(args...);
   }
 
+  F* get() const {
+    return active;
+  }
+
 private:
   F* active = nullptr;
 };
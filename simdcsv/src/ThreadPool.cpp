@@ -0,0 +1,251 @@
+#include "ThreadPool.h"
+
+namespace Wikinger {
+namespace detail {
+namespace pool {
+
+// A Chase-Lev deque as described in "Correct and Efficient Work-Stealing for
+// Weak Memory Models" (Lê, Pop, Cohen, Zappa Nardelli).
+// Only the owning worker may push and pop, any thread may steal.
+class WorkDeque {
+public:
+  WorkDeque();
+
+  void push(Job* job);
+  Job* pop();
+  Job* steal();
+
+private:
+  struct Array {
+    Array(int64_t c) : cap(c), buf(new std::atomic<Job*>[c]) {}
+
+    Job* get(int64_t i) const { return buf[i & (cap - 1)].load(std::memory_order_relaxed); }
+    void put(int64_t i, Job* job) { buf[i & (cap - 1)].store(job, std::memory_order_relaxed); }
+
+    int64_t cap;
+    std::unique_ptr<std::atomic<Job*>[]> buf;
+  };
+
+  Array* grow(Array* a, int64_t top, int64_t bottom);
+
+  std::atomic<int64_t> top;
+  std::atomic<int64_t> bottom;
+  std::atomic<Array*> array;
+
+  // Every array ever used, thieves may still be reading from the old
+  // ones so they are only freed along with the deque.
+  std::vector<std::unique_ptr<Array>> arrays;
+};
+
+WorkDeque::WorkDeque() :
+  top(0), bottom(0) {
+  arrays.emplace_back(new Array(64));
+  array.store(arrays.back().get(), std::memory_order_relaxed);
+}
+
+WorkDeque::Array* WorkDeque::grow(Array* a, int64_t t, int64_t b) {
+  Array* n = new Array(a->cap * 2);
+  for(int64_t i = t; i < b; i++) {
+    n->put(i, a->get(i));
+  }
+  arrays.emplace_back(n);
+  array.store(n, std::memory_order_release);
+  return n;
+}
+
+void WorkDeque::push(Job* job) {
+  int64_t b = bottom.load(std::memory_order_relaxed);
+  int64_t t = top.load(std::memory_order_acquire);
+  Array* a = array.load(std::memory_order_relaxed);
+
+  if(b - t > a->cap - 1)
+    a = grow(a, t, b);
+
+  a->put(b, job);
+  std::atomic_thread_fence(std::memory_order_release);
+  bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+Job* WorkDeque::pop() {
+  int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+  Array* a = array.load(std::memory_order_relaxed);
+  bottom.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t t = top.load(std::memory_order_relaxed);
+
+  if(t > b) {
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  Job* job = a->get(b);
+  if(t == b) {
+    // the last job, race any thieves for it.
+    if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+      job = nullptr;
+    bottom.store(b + 1, std::memory_order_relaxed);
+  }
+  return job;
+}
+
+Job* WorkDeque::steal() {
+  int64_t t = top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t b = bottom.load(std::memory_order_acquire);
+
+  if(t >= b)
+    return nullptr;
+
+  Array* a = array.load(std::memory_order_acquire);
+  Job* job = a->get(t);
+  if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+    return nullptr;
+  return job;
+}
+
+// The pool and index of the worker running on this thread, if any.
+thread_local ThreadPool* currentPool = nullptr;
+thread_local uint32_t currentIndex = 0;
+thread_local uint32_t stealSeed = 0;
+
+}
+}
+
+namespace dpool = detail::pool;
+
+ThreadPool::ThreadPool(uint32_t threads) :
+  injectedCount(0), epoch(0), completed(0), waiters(0), stopping(false) {
+  if(threads == 0)
+    threads = std::thread::hardware_concurrency();
+  if(threads == 0)
+    threads = 1;
+
+  for(uint32_t i = 0; i < threads; i++) {
+    deques.emplace_back(new dpool::WorkDeque());
+  }
+
+  for(uint32_t i = 0; i < threads; i++) {
+    workers.emplace_back(&ThreadPool::work, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+  }
+  cv.notify_all();
+
+  for(std::thread& w : workers) {
+    w.join();
+  }
+
+  // anything submitted during shutdown is run here rather than dropped.
+  while(runOne()) {}
+}
+
+uint32_t ThreadPool::getThreadCount() const {
+  return (uint32_t)workers.size();
+}
+
+// The pool every parallel reader schedules onto unless told otherwise.
+ThreadPool& ThreadPool::getDefault() {
+  static ThreadPool pool;
+  return pool;
+}
+
+// Runs a single job on the calling thread, returns false if none could be found.
+bool ThreadPool::runOne() {
+  dpool::Job* job = find();
+  if(job == nullptr)
+    return false;
+
+  execute(job);
+  return true;
+}
+
+void ThreadPool::push(dpool::Job* job) {
+  if(dpool::currentPool == this) {
+    deques[dpool::currentIndex]->push(job);
+    std::lock_guard<std::mutex> lock(mtx);
+    epoch++;
+  }
+  else {
+    std::lock_guard<std::mutex> lock(mtx);
+    injected.push_back(job);
+    injectedCount.fetch_add(1, std::memory_order_release);
+    epoch++;
+  }
+  cv.notify_one();
+}
+
+// Looks for a job in the order of the own deque, the shared queue
+// and then the deques of the other workers.
+dpool::Job* ThreadPool::find() {
+  bool worker = dpool::currentPool == this;
+  dpool::Job* job = nullptr;
+
+  if(worker) {
+    job = deques[dpool::currentIndex]->pop();
+    if(job != nullptr)
+      return job;
+  }
+
+  if(injectedCount.load(std::memory_order_acquire) > 0) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if(!injected.empty()) {
+      job = injected.front();
+      injected.pop_front();
+      injectedCount.fetch_sub(1, std::memory_order_relaxed);
+      return job;
+    }
+  }
+
+  size_t n = deques.size();
+  size_t start = dpool::stealSeed++;
+  for(size_t i = 0; i < n; i++) {
+    size_t victim = (start + i) % n;
+    if(worker && victim == dpool::currentIndex)
+      continue;
+
+    job = deques[victim]->steal();
+    if(job != nullptr)
+      return job;
+  }
+
+  return nullptr;
+}
+
+void ThreadPool::execute(dpool::Job* job) {
+  job->fn();
+  if(job->pending != nullptr)
+    job->pending->fetch_sub(1, std::memory_order_release);
+  delete job;
+
+  std::lock_guard<std::mutex> lock(mtx);
+  completed++;
+  if(waiters > 0)
+    cv.notify_all();
+}
+
+void ThreadPool::work(uint32_t index) {
+  dpool::currentPool = this;
+  dpool::currentIndex = index;
+  dpool::stealSeed = index + 1;
+
+  std::unique_lock<std::mutex> lock(mtx);
+  while(true) {
+    uint64_t seen = epoch;
+    lock.unlock();
+
+    while(runOne()) {}
+
+    lock.lock();
+    if(stopping)
+      break;
+
+    cv.wait(lock, [this, seen]() { return stopping || epoch != seen; });
+  }
+}
+
+}
@@ -0,0 +1,103 @@
+#ifndef WK_THREADPOOL_H
+#define WK_THREADPOOL_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Wikinger {
+
+namespace detail {
+namespace pool {
+
+struct Job {
+  std::function<void()> fn;
+
+  // The pending counter of the group the job belongs to or nullptr.
+  std::atomic<size_t>* pending;
+};
+
+class WorkDeque;
+
+}
+}
+
+// A work-stealing thread pool, every worker has a deque of its own which it pushes
+// to and pops from while idle workers steal from the other end of the others.
+// Jobs submitted from threads outside of the pool are put in a shared queue.
+// Waiting on a group is cooperative, the waiting thread runs jobs until the
+// group is done which means that groups can be nested without blocking workers.
+class ThreadPool {
+public:
+  // A set of jobs that can be waited on, a group waits for its jobs when destroyed.
+  class Group {
+  public:
+    Group(ThreadPool& pool);
+    ~Group();
+
+    template<typename Fn>
+    void run(Fn&& fn);
+
+    void wait();
+
+  private:
+    ThreadPool& pool;
+    std::atomic<size_t> pending;
+  };
+
+  // threads = 0 uses one worker per hardware thread.
+  ThreadPool(uint32_t threads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  uint32_t getThreadCount() const;
+
+  template<typename Fn>
+  void submit(Fn&& fn);
+
+  template<typename Pred>
+  void waitUntil(Pred&& pred);
+
+  bool runOne();
+
+  static ThreadPool& getDefault();
+
+private:
+  void push(detail::pool::Job* job);
+  detail::pool::Job* find();
+  void execute(detail::pool::Job* job);
+  void work(uint32_t index);
+
+  std::vector<std::unique_ptr<detail::pool::WorkDeque>> deques;
+  std::vector<std::thread> workers;
+
+  // jobs submitted from outside of the pool, guarded by mtx.
+  std::deque<detail::pool::Job*> injected;
+  std::atomic<size_t> injectedCount;
+
+  // epoch is incremented for every job pushed so that a worker
+  // going to sleep can tell whether it missed any.
+  // completed is incremented for every job finished, the threads blocked in
+  // waitUntil are woken by either and counted in waiters.
+  std::mutex mtx;
+  std::condition_variable cv;
+  uint64_t epoch;
+  uint64_t completed;
+  uint32_t waiters;
+  bool stopping;
+};
+
+}
+
+#include "ThreadPool.inl"
+
+#endif// WK_THREADPOOL_H
@@ -0,0 +1,50 @@
+#include "ThreadPool.h"
+
+namespace Wikinger {
+
+inline ThreadPool::Group::Group(ThreadPool& p) :
+  pool(p), pending(0) {}
+
+inline ThreadPool::Group::~Group() {
+  wait();
+}
+
+template<typename Fn>
+void ThreadPool::Group::run(Fn&& fn) {
+  pending.fetch_add(1, std::memory_order_relaxed);
+  pool.push(new detail::pool::Job{ std::forward<Fn>(fn), &pending });
+}
+
+inline void ThreadPool::Group::wait() {
+  pool.waitUntil([this]() { return pending.load(std::memory_order_acquire) == 0; });
+}
+
+// Runs fn on the pool without any way of waiting for it.
+template<typename Fn>
+void ThreadPool::submit(Fn&& fn) {
+  push(new detail::pool::Job{ std::forward<Fn>(fn), nullptr });
+}
+
+// Runs pending jobs on the calling thread until pred returns true, pred has
+// to be made true by a job of the pool. When there is nothing left to run the
+// thread sleeps until a job is pushed or finishes.
+template<typename Pred>
+void ThreadPool::waitUntil(Pred&& pred) {
+  while(!pred()) {
+    if(runOne())
+      continue;
+
+    std::unique_lock<std::mutex> lock(mtx);
+    uint64_t pushed = epoch;
+    uint64_t done = completed;
+    // a job finishing after this check has to take the lock to say so.
+    if(pred())
+      break;
+
+    waiters++;
+    cv.wait(lock, [this, pushed, done]() { return stopping || epoch != pushed || completed != done; });
+    waiters--;
+  }
+}
+
+}